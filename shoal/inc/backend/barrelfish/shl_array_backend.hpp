@@ -179,10 +179,8 @@ int shl_array<T>::copy_from_array(shl_array<T> *src_array)
     tCopy.start();
     if (start < elements) {
         T* src = src_array->get_array();
-#pragma omp parallel for
-        for (size_t i = start; i < elements; ++i) {
-            array[i] = src[i];
-        }
+        shl__memcpy_parallel(array + start, src + start,
+                             (elements - start) * sizeof(T));
     }
     tCopy.stop();
 
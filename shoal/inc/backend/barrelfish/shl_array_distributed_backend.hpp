@@ -29,10 +29,24 @@ int shl_array_distributed<T>::alloc(void)
     }
 
     this->alloc_done = true;
+    this->owns_memory = true;
 
     return 0;
 
 }
 
+template<class T>
+int shl_array_distributed<T>::get_node(size_t i)
+{
+    struct shl_mi_header *mi = (struct shl_mi_header *) this->meminfo;
+    if (mi == NULL) {
+        return -1;
+    }
+
+    // shl__malloc_distributed allocates the i-th frame on node i
+    size_t block = (i * sizeof(T)) / mi->stride;
+
+    return block % mi->num;
+}
 
 #endif /* __SHL_ARRAY_DISTRIBUTED_BACKEND */
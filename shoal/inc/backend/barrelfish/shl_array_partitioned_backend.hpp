@@ -32,6 +32,7 @@ int shl_array_partitioned<T>::alloc(void)
     }
 
     this->alloc_done = true;
+    this->owns_memory = true;
 
     return 0;
 }
@@ -24,15 +24,17 @@ int shl_array_replicated<T>::alloc(void)
 
     assert(!this->alloc_done);
 
-    rep_array = (T**) shl__malloc_replicated(this->size * sizeof(T),
-                                              &num_replicas, &this->pagesize,
-                                              this->get_options(),
-                                              &this->meminfo);
+    rep_array = (T**) shl__malloc_replicated_domain(this->size * sizeof(T),
+                                                     domain, &num_replicas,
+                                                     &this->pagesize,
+                                                     this->get_options(),
+                                                     &this->meminfo);
     if (this->rep_array == NULL) {
         return -1;
     }
 
     this->alloc_done = true;
+    this->owns_memory = true;
 
     return 0;
 }
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2014 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef SHL__BACKEND_LINUX_MEMINFO_H
+#define SHL__BACKEND_LINUX_MEMINFO_H
+
+#include <stddef.h>
+
+/**
+ * \brief Memory backing an array on one node
+ */
+struct shl_mi_data {
+    void *vaddr;            ///< first byte of the array on that node
+    size_t size;            ///< bytes of the array on that node
+    int node;               ///< the node
+};
+
+/**
+ * \brief Linux memory information of an array
+ *
+ * Depending on the kind of array, data is interpreted as follows:
+ *
+ * - distributed (stride != 0): block b of stride bytes starting at
+ *   vaddr is on node data[b % num].node
+ *
+ * - contiguous (stride == 0, vaddr != NULL): data holds consecutive
+ *   extents of the array starting at vaddr
+ *
+ * - replicated (vaddr == NULL): every entry of data holds a complete
+ *   copy of the array
+ *
+ * A node of SHL_NUMA_IGNORE means that placement is not known.
+ *
+ * The array is backed by a single mapping of map_size bytes starting
+ * at vaddr, or, if replicated, by one such mapping per replica.
+ */
+struct shl_mi_header {
+    size_t num;             ///< number of entries in data
+    size_t stride;          ///< distribution stride in bytes
+    void *vaddr;            ///< start of the array
+    size_t map_size;        ///< length of the mapping(s) in bytes
+    int pagesize;           ///< page size of the mapping(s)
+    int opts;               ///< SHL_MALLOC_* options used for allocation
+    struct shl_mi_data *data;
+};
+
+/**
+ * \brief called for every part of an array
+ *
+ * \param addr   virtual address of the part
+ * \param offset offset of the part from the start of the array
+ * \param bytes  size of the part
+ * \param node   node the part is on
+ */
+typedef size_t (*shl__mi_fn_t)(char *addr, size_t offset, size_t bytes,
+                               int node, void *arg);
+
+size_t shl__mi_foreach(struct shl_mi_header *mi, size_t size,
+                       shl__mi_fn_t fn, void *arg);
+
+#endif /* SHL__BACKEND_LINUX_MEMINFO_H */
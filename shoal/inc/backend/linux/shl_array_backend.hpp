@@ -12,10 +12,47 @@
 
 
 
+/**
+ * \brief Pattern of 8 bytes holding copies of value, as used by
+ * shl__memset_dma
+ *
+ * \returns false if T does not tile 8 bytes
+ */
+template<class T>
+static bool shl__dma_pattern(T value, uint64_t *pattern)
+{
+    if (sizeof(T) > sizeof(uint64_t) || sizeof(uint64_t) % sizeof(T)) {
+        return false;
+    }
+
+    uint8_t *ptr = (uint8_t *) pattern;
+    for (unsigned i = 0; i < sizeof(uint64_t) / sizeof(T); ++i) {
+        memcpy(ptr, &value, sizeof(T));
+        ptr += sizeof(T);
+    }
+
+    return true;
+}
+
 template<class T>
 int shl_array<T>::copy_from_array_async(shl_array<T> *src_array, size_t elements)
 {
-    return -1;
+    assert(dma_total_tx == 0 && dma_compl_tx == 0);
+
+    if (!get_conf()->use_dma || !meminfo || !src_array->get_meminfo()) {
+        return -1;
+    }
+
+    dma_total_tx = shl__memcpy_dma_array(src_array->get_meminfo(), meminfo,
+                                         sizeof(T) * elements,
+                                         &dma_compl_tx);
+
+    if (dma_total_tx == 0) {
+        dma_compl_tx = 0;
+        return -1;
+    }
+
+    return 0;
 }
 
 /*
@@ -32,7 +69,22 @@ int shl_array<T>::copy_from_array_async(shl_array<T> *src_array, size_t elements
 template<class T>
 int shl_array<T>::init_from_value_async(T value, size_t elements)
 {
-    return -1;
+    assert(dma_total_tx == 0 && dma_compl_tx == 0);
+
+    uint64_t val = 0;
+    if (!get_conf()->use_dma || !meminfo || !shl__dma_pattern(value, &val)) {
+        return -1;
+    }
+
+    dma_total_tx = shl__memset_dma(meminfo, val, sizeof(T) * elements,
+                                   &dma_compl_tx);
+
+    if (dma_total_tx == 0) {
+        dma_compl_tx = 0;
+        return -1;
+    }
+
+    return 0;
 }
 
 /*
@@ -49,7 +101,25 @@ int shl_array<T>::init_from_value_async(T value, size_t elements)
 template<class T>
 int shl_array<T>::copy_from_async(T* src, size_t elements)
 {
-    return -1;
+    if (!do_copy_in()) {
+        return 0;
+    }
+
+    if (!get_conf()->use_dma || !meminfo) {
+        return -1;
+    }
+
+    assert(dma_total_tx == 0 && dma_compl_tx == 0);
+
+    dma_total_tx = shl__memcpy_dma_from(src, meminfo, sizeof(T) * elements,
+                                        &dma_compl_tx);
+
+    if (dma_total_tx == 0) {
+        dma_compl_tx = 0;
+        return -1;
+    }
+
+    return 0;
 }
 
 /*
@@ -67,7 +137,21 @@ int shl_array<T>::copy_from_async(T* src, size_t elements)
 template<class T>
 int shl_array<T>::copy_back_async(T* dest, size_t elements)
 {
-    return -1;
+    assert(dma_total_tx == 0 && dma_compl_tx == 0);
+
+    if (!get_conf()->use_dma || !meminfo) {
+        return -1;
+    }
+
+    dma_total_tx = shl__memcpy_dma_to(meminfo, dest, sizeof(T) * elements,
+                                      &dma_compl_tx);
+
+    if (dma_total_tx == 0) {
+        dma_compl_tx = 0;
+        return -1;
+    }
+
+    return 0;
 }
 
 template<class T>
@@ -76,17 +160,39 @@ int shl_array<T>::copy_from_array(shl_array<T> *src_array)
     size_t max = (src_array->get_size() > shl_array<T>::size) ?
         shl_array<T>::size : src_array->get_size();
 
-#pragma omp parallel for
-    for (size_t i=0; i<max; i++) {
-        shl_array<T>::array[i] = src_array->array[i];
+    size_t start = (max / 100 * dma_fraction);
+
+    if ((start > 0) && copy_from_array_async(src_array, start) != 0) {
+        start = 0;
     }
 
+    shl__memcpy_parallel(shl_array<T>::array + start, src_array->array + start,
+                         (max - start) * sizeof(T));
+
+    copy_barrier();
+
     return 0;
 }
 
+/**
+ * \brief blocks until the copy threads completed all requests of this array
+ */
 template<class T>
 void shl_array<T>::copy_barrier(void)
 {
+    if (dma_total_tx == 0) {
+        return;
+    }
+
+    volatile size_t *vol_dma_compl = &dma_compl_tx;
+
+    while (dma_total_tx != *vol_dma_compl) {
+        poll_count++;
+        shl__memcpy_poll();
+    }
+
+    dma_total_tx = 0;
+    dma_compl_tx = 0;
 }
 
 
@@ -11,10 +11,55 @@
 #define __SHL_ARRAY_DISTRIBUTED_BACKEND
 
 
+#include <backend/linux/meminfo.h>
+
 template<class T>
 int shl_array_distributed<T>::alloc(void)
 {
-    return shl_array<T>::alloc();
+    if (!this->do_alloc())
+        return 0;
+
+    this->print();
+
+    assert(!this->alloc_done);
+
+    this->array = (T *)shl__malloc_distributed(this->size * sizeof(T),
+                                               this->get_options(), &this->pagesize,
+                                               get_conf()->stride, &this->meminfo);
+
+    if (this->array == NULL) {
+        return -1;
+    }
+
+    this->alloc_done = true;
+    this->owns_memory = true;
+
+    return 0;
+}
+
+template<class T>
+int shl_array_distributed<T>::get_node(size_t i)
+{
+    struct shl_mi_header *mi = (struct shl_mi_header *) this->meminfo;
+    if (mi == NULL) {
+        return -1;
+    }
+
+    size_t offset = i * sizeof(T);
+
+    if (mi->stride) {
+        return mi->data[(offset / mi->stride) % mi->num].node;
+    }
+
+    // Consecutive extents, e.g. after migrate (see shl__mi_foreach)
+    for (size_t j=0; j<mi->num; j++) {
+        if (offset < mi->data[j].size) {
+            return mi->data[j].node;
+        }
+        offset -= mi->data[j].size;
+    }
+
+    return -1;
 }
 
 #endif /* __SHL_ARRAY_DISTRIBUTED_BACKEND */
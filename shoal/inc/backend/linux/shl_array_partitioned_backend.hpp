@@ -17,19 +17,25 @@ int shl_array_partitioned<T>::alloc(void)
     if (!this->do_alloc())
         return 0;
 
-    shl_array<T>::alloc();
+    this->print();
 
-    // We need to force memory allocation in here (which sucks,
-    // since this file is supposed to be platform independent),
-    // since in shl_malloc, we do not know the size of elements,
-    // and hence, we cannot establish a correct memory mapping for
-    // partitioning in there.
-#pragma omp parallel for schedule(static, 1024)
-    for (unsigned int i = 0; i < shl_array<T>::size; i++) {
+    assert(!this->alloc_done);
 
-        shl_array<T>::array[i] = 0;
+    // Pages are bound to the nodes of the threads touching them
+    // under the static schedule; this needs the element size, which
+    // is why partitioning has its own allocation function.
+    this->array = (T *)shl__malloc_partitioned(this->size * sizeof(T), sizeof(T),
+                                               get_conf()->chunk,
+                                               this->get_options(), &this->pagesize,
+                                               &this->meminfo);
+
+    if (this->array == NULL) {
+        return -1;
     }
 
+    this->alloc_done = true;
+    this->owns_memory = true;
+
     return 0;
 }
 
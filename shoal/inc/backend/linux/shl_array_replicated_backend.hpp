@@ -24,15 +24,17 @@ int shl_array_replicated<T>::alloc(void)
 
     assert(!this->alloc_done);
 
-    rep_array = (T**) shl__malloc_replicated(this->size * sizeof(T),
-                                              &num_replicas, &this->pagesize,
-                                              this->get_options(),
-                                              &this->meminfo);
+    rep_array = (T**) shl__malloc_replicated_domain(this->size * sizeof(T),
+                                                     domain, &num_replicas,
+                                                     &this->pagesize,
+                                                     this->get_options(),
+                                                     &this->meminfo);
     if (this->rep_array == NULL) {
         return -1;
     }
 
     this->alloc_done = true;
+    this->owns_memory = true;
 
     return 0;
 }
@@ -43,19 +45,63 @@ int shl_array_replicated<T>::copy_from_async(T* src, size_t elements)
     if (!this->do_copy_in())
         return 0;
 
-    return -1;
+    if (!get_conf()->use_dma || !this->meminfo) {
+        return -1;
+    }
+
+    assert(this->dma_total_tx == 0 && this->dma_compl_tx == 0);
+
+    this->dma_total_tx = shl__memcpy_dma_from(src, this->meminfo,
+                                              sizeof(T) * elements,
+                                              &this->dma_compl_tx);
+
+    if (this->dma_total_tx == 0) {
+        this->dma_compl_tx = 0;
+        return -1;
+    }
+
+    return 0;
 }
 
 template<class T>
 int shl_array_replicated<T>::copy_from_array_async(shl_array<T> *src, size_t elements)
 {
-    return -1;
+    if (!get_conf()->use_dma || !this->meminfo || !src->get_meminfo()) {
+        return -1;
+    }
+
+    assert(this->dma_total_tx == 0 && this->dma_compl_tx == 0);
+
+    this->dma_total_tx = shl__memcpy_dma_array(src->get_meminfo(), this->meminfo,
+                                               sizeof(T) * elements,
+                                               &this->dma_compl_tx);
+    if (this->dma_total_tx == 0) {
+        this->dma_compl_tx = 0;
+        return -1;
+    }
+
+    return 0;
 }
 
 template<class T>
 int shl_array_replicated<T>::init_from_value_async(T value, size_t elements)
 {
-    return -1;
+    uint64_t val = 0;
+    if (!get_conf()->use_dma || !this->meminfo || !shl__dma_pattern(value, &val)) {
+        return -1;
+    }
+
+    assert(this->dma_total_tx == 0 && this->dma_compl_tx == 0);
+
+    this->dma_total_tx = shl__memset_dma(this->meminfo, val, sizeof(T) * elements,
+                                         &this->dma_compl_tx);
+
+    if (this->dma_total_tx == 0) {
+        this->dma_compl_tx = 0;
+        return -1;
+    }
+
+    return 0;
 }
 
 template<class T>
@@ -6,6 +6,19 @@
 #include <numa.h>
 #include <omp.h>
 
-#define PRIuCOREID "zu"
+/**
+ * \brief This file contains Linux specific declarations
+ */
+
+/* software DMA: size of a single copy request in bytes */
+#define SHL_DMA_REQUEST_SIZE (2*1024*1024)
+
+/* software DMA: default number of copy threads per node */
+#define SHL_DMA_THREADS 1
+
+/* additional allocation functions */
+void* shl__malloc_distributed(size_t size, int opts, int *pagesize, size_t stride, void **ret_mi);
+void *shl__malloc_partitioned(size_t size, size_t element_size, size_t chunk,
+                              int opts, int *pagesize, void **ret_mi);
 
 #endif
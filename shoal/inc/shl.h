@@ -21,9 +21,7 @@ extern "C" {
 
 #ifdef BARRELFISH
 #include "barrelfish.h"
-#endif
-
-#ifdef LINUX
+#else
 #include "linux.h"
 #endif
 
@@ -50,8 +48,15 @@ extern "C" {
 ///< which timer version to use
 #define SHL_TIMER_USE_MULTI 1
 
-///< Size of a cacheline (bytes)
-#define CACHELINE 8
+///< Size of a cacheline (bytes), per-thread state is padded to it.
+///< Compare with shl__cacheline_size(), and override with -DCACHELINE=
+#ifndef CACHELINE
+#if defined(__powerpc64__) || defined(__aarch64__)
+#define CACHELINE 128
+#else
+#define CACHELINE 64
+#endif
+#endif
 
 ///< size of a huge page (2 MB)
 #define PAGESIZE_HUGE (2*1024*1024)
@@ -59,6 +64,18 @@ extern "C" {
 ///< size of a page (4 kB)
 #define PAGESIZE (4*1024)
 
+///< default chunk size of the OpenMP static schedule partitioned arrays match
+#define SHL_PARTITION_CHUNK 1024
+
+///< bulk copies/fills of at least this many bytes bypass the cache
+#define SHL_STREAM_THRESHOLD (4*1024*1024)
+
+///< bulk copies/fills smaller than this are done by a single thread
+#define SHL_PARALLEL_THRESHOLD (64*1024)
+
+///< default capacity of the pool of released mappings (MB)
+#define SHL_POOL_SIZE 256
+
 ///< enabling and disabling debug output
 #define SHL_DEBUG_ENABLED 1
 
@@ -92,7 +109,6 @@ extern "C" {
 #define KILO BASE_UNIT
 #define MEGA (KILO*BASE_UNIT)
 #define GIGA (MEGA*BASE_UNIT)
-#define MAXCORES 100
 
 
 
@@ -162,10 +178,44 @@ int shl__get_proc_for_node(int node);
 int shl__max_node(void);
 long shl__node_size(int node, long *freep);
 int shl__node_from_cpu(int core_id);
+int shl__node_distance(int node_a, int node_b);
+
+// --------------------------------------------------
+// Topology (Linux), built by shl__init
+// --------------------------------------------------
+void shl__topo_init(void);
+bool shl__topo_ready(void);
+int  shl__topo_num_cpus(void);
+int  shl__topo_cpu_node(int cpu);
+int  shl__topo_cpu_core(int cpu);
+int  shl__topo_cpu_llc(int cpu);
+bool shl__topo_cpu_allowed(int cpu);
+int  shl__topo_allowed_cpus(const int **cpus);
+int  shl__topo_node_cpus(int node, const int **cpus);
+int  shl__topo_node_distance(int node_a, int node_b);
+struct shl_rep_domain;
+size_t shl__mem_free(int node);
+bool shl__mem_reserve(int node, size_t bytes, bool force);
+void shl__mem_release(int node, size_t bytes);
 void* shl__malloc(size_t size, int opts, int *pagesize, int node, void **ret_mi);
 void** shl__malloc_replicated(size_t size, int* num_replicas, int* pagesize, int options, void ** ret_mi);
+void** shl__malloc_replicated_domain(size_t size, const struct shl_rep_domain *domain,
+                                     int* num_replicas, int* pagesize, int options,
+                                     void ** ret_mi);
+void shl__free(void *addr, void *mi);
+void shl__free_replicated(void **replicas, void *mi);
+struct shl__migrate_stats {
+    size_t pages;           ///< pages of the array
+    size_t bytes_moved;     ///< bytes moved to another node
+    size_t pages_failed;    ///< present pages that could not be moved
+    double time;            ///< elapsed time in seconds
+};
+int shl__migrate(void *addr, size_t size, size_t element_size, int opts,
+                 int node, size_t stride, size_t chunk, void **mi,
+                 struct shl__migrate_stats *stats);
 
 bool shl__check_hugepage_support(void);
+int shl__cacheline_size(void);
 bool shl__check_largepage_support(void);
 
 void loc(size_t, int, int*, void **);
@@ -178,16 +228,62 @@ void shl__start(void);
 void shl__thread_init(void);
 int  shl__get_rep_id(void);
 int  shl__lookup_rep_id(int);
-void shl__repl_sync(void*, void**, size_t, size_t);
+size_t shl__static_schedule_owner(size_t, size_t, size_t, size_t);
+int  shl__get_cur_rep_id(void);
+void shl__rep_epoch_bump(void);
+void shl__rep_thread_epoch_bump(void);
+struct shl__dirty_region;
+void shl__repl_sync(void*, struct shl__dirty_region*, void**, size_t, size_t,
+                    const struct shl_rep_domain*);
+struct shl__range {
+    size_t offset;      ///< offset in bytes
+    size_t size;        ///< size in bytes
+};
+struct shl__dirty_region* shl__dirty_track(void *addr, size_t size);
+void shl__dirty_untrack(struct shl__dirty_region *r);
+long shl__dirty_collect(struct shl__dirty_region *r, struct shl__range **runs);
+typedef void (*shl__fill_fn_t)(void *dst, size_t offset, size_t size, void *arg);
+int  shl__repl_canonical(void **replicas, int r);
+void shl__repl_fill(void **replicas, int num_replicas, size_t offset,
+                    size_t size, size_t element_size,
+                    shl__fill_fn_t fn, void *arg,
+                    const struct shl_rep_domain *domain);
+void shl__repl_exchange(void **replicas, int num_replicas,
+                        const struct shl_rep_domain *domain,
+                        struct shl__range *runs, const int *owner,
+                        long num_runs);
 void shl__init_thread(int);
+int  shl__register_thread(int);
+void shl__deregister_thread(void);
 void handle_error(int);
 int  shl__get_num_replicas(void);
+int  shl__get_rep_node(int);
+int  shl__rep_of_node(int);
+struct shl_rep_domain* shl__rep_domain_llc(void);
+struct shl_rep_domain* shl__rep_domain_custom(const int *group, int num_cpus);
+void shl__rep_domain_free(struct shl_rep_domain*);
+int  shl__rep_domain_num(const struct shl_rep_domain*);
+int  shl__rep_domain_node(const struct shl_rep_domain*, int);
+int  shl__rep_domain_lookup(const struct shl_rep_domain*);
+int  shl__rep_domain_lookup_tid(const struct shl_rep_domain*, int);
 size_t shl__init(uint32_t,bool);
 int  shl__num_threads(void);
+int  shl__max_threads(void);
 int  shl__get_tid(void);
 int  shl__rep_coordinator(int);
+void shl__rep_coordinators_update(void);
 bool shl__is_rep_coordinator(int);
 // --------------------------------------------------
+// Bulk copy/fill
+// --------------------------------------------------
+const char *shl__simd_name(void);
+void shl__memcpy_simd(void *dst, const void *src, size_t size, bool stream);
+void shl__memset_simd(void *dst, const void *value, size_t element_size,
+                      size_t size, bool stream);
+void shl__memcpy_parallel(void *dst, const void *src, size_t size);
+void shl__memset_parallel(void *dst, const void *value, size_t element_size,
+                          size_t size);
+// --------------------------------------------------
 // PAPI
 // --------------------------------------------------
 void papi_stop(void);
@@ -208,9 +304,6 @@ unsigned long shl__calculate_crc(void *array, size_t elements, size_t element_si
 
 // --------------------------------------------------
 // Auto-tuning interface
-//
-// Non of these functions are implemented. These are just meant as
-// ideas for a future potential auto-tuning interface.
 // --------------------------------------------------
 
 /**
@@ -235,12 +328,38 @@ unsigned long shl__calculate_crc(void *array, size_t elements, size_t element_si
  * always good to spread out to several nodes. Somethings it is better
  * to use up all H/W threads on a node before going to the next one,
  * even if some of the threads will be hyperthreads.
+ *
+ * On Linux, the decision between the two is taken by a short
+ * bandwidth and latency probe (global.autotune = 2), or configured
+ * with global.autotune_fill. shl__init uses this placement if
+ * SHL_CPU_AFFINITY is not given.
+ *
+ * \param num_cores upper limit of threads (<= 0: unlimited), returns
+ *     the number of threads to use
+ * \param bind returns the CPU of every thread, or NULL
  */
 void shl__auto_tune_bind(int *num_cores,
                          coreid_t *bind,
                          bool uses_barriers);
 
-extern int replica_lookup[];
+extern int *replica_lookup;
+extern unsigned long replica_epoch;
+#ifndef BARRELFISH
+extern __thread unsigned long replica_thread_epoch;
+#endif
+
+/**
+ * \brief Return the epoch replica pointers cached by the calling thread
+ * have to be resolved in
+ */
+static inline unsigned long shl__rep_epoch(void)
+{
+#ifndef BARRELFISH
+    return replica_epoch + replica_thread_epoch;
+#else
+    return replica_epoch;
+#endif
+}
 
 
 
@@ -266,6 +385,7 @@ extern int replica_lookup[];
 #define SHL_MALLOC_REPLICATED  (0x1<<3)
 #define SHL_MALLOC_SINGLE_NODE (0x1<<4)
 #define SHL_MALLOC_LARGEPAGE   (0x1<<5)   // for MB pages
+#define SHL_MALLOC_POOLED      (0x1<<6)   // recycle the mapping on free
 
 #define SHL_NUMA_IGNORE (-1)
 
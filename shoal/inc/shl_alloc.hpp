@@ -26,6 +26,8 @@
 // Allocation
 // --------------------------------------------------
 
+array_t shl__admit_array(const char *name, size_t size, array_t type);
+
 /**
  *\ brief Allocate array
  *
@@ -50,6 +52,8 @@
  * - huge pages: Use if working set < available RAM && alloc_real/size < 1.xx
  *   (this is not yet implemented, currently, we always use huge pages)
  *
+ * - capacity: arrays that do not fit are downgraded, see shl__admit_array
+ *
  */
 template<class T>
 shl_array<T>* shl__malloc_array(size_t size, const char *name,
@@ -77,17 +81,23 @@ shl_array<T>* shl__malloc_array(size_t size, const char *name,
        get_conf()->use_distribution &&
        shl__get_array_conf(name, SHL_ARR_FEAT_DISTRIBUTION, true);
 
+   // 4) Downgrade if the nodes cannot hold the array
+   array_t type = partition ? SHL_A_PARTITIONED :
+       replicate ? SHL_A_REPLICATED :
+       distribute ? SHL_A_DISTRIBUTED : SHL_A_SINGLE_NODE;
+   type = shl__admit_array(name, size * sizeof(T), type);
+
     shl_array<T> *res = NULL;
     if (get_conf()->num_nodes_active == 0) {
         SHL_DEBUG_ALLOC("allocating single_node array '%s'\n", name);
         res = new shl_array_single_node<T>(size, name);
-    } else if (partition) {
+    } else if (type == SHL_A_PARTITIONED) {
         SHL_DEBUG_ALLOC("allocating partitioned array '%s'\n", name);
         res = new shl_array_partitioned<T>(size, name);
-    } else if (replicate) {
+    } else if (type == SHL_A_REPLICATED) {
         SHL_DEBUG_ALLOC("allocating replicated array '%s'\n", name);
         res = new shl_array_replicated<T>(size, name, shl__get_rep_id);
-    } else if (distribute) {
+    } else if (type == SHL_A_DISTRIBUTED) {
         SHL_DEBUG_ALLOC("allocating distributed array '%s'\n", name);
         res = new shl_array_distributed<T>(size, name);
     } else {
@@ -104,6 +114,32 @@ shl_array<T>* shl__malloc_array(size_t size, const char *name,
     return res;
 }
 
+/**
+ * \brief Allocate current and next buffer of an iterative algorithm
+ *
+ * Both buffers are written, so neither is replicated. They are
+ * allocated with the same policy, see shl__malloc_array for the
+ * parameters.
+ */
+template<class T>
+shl_array_double_buffered<T>* shl__malloc_double_buffered(size_t size,
+                                                          const char *name,
+                                                          bool is_dynamic,
+                                                          bool is_used,
+                                                          bool is_graph,
+                                                          bool is_indexed,
+                                                          bool initialize)
+{
+    shl_array<T> *cur = shl__malloc_array<T>(size, name, false, is_dynamic,
+                                             is_used, is_graph, is_indexed,
+                                             initialize);
+    shl_array<T> *next = shl__malloc_array<T>(size, name, false, is_dynamic,
+                                              is_used, is_graph, is_indexed,
+                                              initialize);
+
+    return new shl_array_double_buffered<T>(cur, next);
+}
+
 template<class T>
 shl_array<T>* shl__remalloc_array(size_t size, const char *name,
                                   void *data, void *meminfo,
@@ -13,6 +13,7 @@
 #include <cstdlib>
 #include <cstdarg>
 #include <cstring> // memset
+#include <algorithm>
 #include <iostream>
 #include <limits>
 #include <stdio.h>
@@ -40,7 +41,9 @@ typedef enum array_type {
     SHL_A_PARTITIONED,
     SHL_A_REPLICATED,
     SHL_A_EXPANDABLE,
-    SHL_A_WR_REPLICATED
+    SHL_A_WR_REPLICATED,
+    SHL_A_OPLOG,
+    SHL_A_PART_REPLICATED
 } array_t;
 
 ///< Enables array access profiling
@@ -134,6 +137,11 @@ class shl_array : public shl_base_array {
     void *meminfo;      ///< backend specific memory information
     T* array;           ///< pointer to the backing memory region
 
+    /// The memory was allocated by alloc(). Memory supplied to
+    /// the constructor belongs to the caller and is not freed
+    /// with the array.
+    bool owns_memory;
+
     uint8_t dma_fraction;
 
 #ifdef PROFILE
@@ -170,6 +178,7 @@ class shl_array : public shl_base_array {
         is_used = false;
         meminfo = NULL;
         array = NULL;
+        owns_memory = false;
         pagesize = 0;
         dma_total_tx = 0;
         dma_compl_tx = 0;
@@ -218,15 +227,17 @@ class shl_array : public shl_base_array {
 
     /**
      * \brief Array destructor
+     *
+     * Releases the backing memory if it was allocated by the array.
      */
     virtual ~shl_array(void)
     {
-        // TODO: implementation
-        // if (array!=NULL) {
-        //     free(array);
-        // }
+        if (owns_memory) {
+            shl__free(array, meminfo);
+        }
 
-        // array = NULL;
+        array = NULL;
+        meminfo = NULL;
     }
 
     /*
@@ -288,6 +299,10 @@ class shl_array : public shl_base_array {
         else if (use_largepage)
             options |= SHL_MALLOC_LARGEPAGE;
 
+        // Dynamic arrays are allocated over and over again
+        if (is_dynamic)
+            options |= SHL_MALLOC_POOLED;
+
         return options;
     }
 
@@ -472,14 +487,115 @@ class shl_array : public shl_base_array {
 
         array = (T*) shl__malloc(size * sizeof(T), get_options(), &pagesize,
                                  numa_node, &meminfo);
+        if (array == NULL) {
+            return -1;
+        }
 
         printf("pagesize used is %u\n", pagesize);
 
         alloc_done = true;
+        owns_memory = true;
 
         return 0;
     }
 
+    /*
+     * ---------------------------------------------------------------------------
+     * Migration
+     * ---------------------------------------------------------------------------
+     */
+
+    /**
+     * \brief moves the pages of the array according to a new policy
+     *
+     * \param opts   SHL_MALLOC_DISTRIBUTED, SHL_MALLOC_PARTITION, or
+     *     SHL_MALLOC_SINGLE_NODE to move everything to node
+     * \param node   target node of SHL_MALLOC_SINGLE_NODE
+     * \param stride block size of SHL_MALLOC_DISTRIBUTED in bytes
+     * \param chunk  chunk size of the static schedule of SHL_MALLOC_PARTITION
+     * \param stats  returns bytes moved and elapsed time, may be NULL
+     *
+     * \returns 0 on success, -1 if the array cannot be migrated
+     *
+     * The contents and the address of the array do not change, only
+     * the location of its pages (see shl__migrate). Replicated arrays
+     * and arrays using memory supplied to the constructor cannot be
+     * migrated.
+     */
+    int replace(int opts, int node, size_t stride, size_t chunk,
+                struct shl__migrate_stats *stats = NULL)
+    {
+        if (!owns_memory || array == NULL) {
+            return -1;
+        }
+
+        struct shl__migrate_stats s;
+        int err = shl__migrate(array, size * sizeof(T), sizeof(T), opts, node,
+                               stride, chunk, &meminfo, &s);
+        if (err) {
+            return err;
+        }
+
+        printf("array [%-30s] migrated: %zu of %zu bytes moved in %.3f ms\n",
+               shl_base_array::name, s.bytes_moved, size * sizeof(T),
+               s.time * 1000);
+
+        if (stats) {
+            *stats = s;
+        }
+
+        return 0;
+    }
+
+    /**
+     * \brief moves the array to a single node
+     */
+    int migrate(int node, struct shl__migrate_stats *stats = NULL)
+    {
+        return replace(SHL_MALLOC_SINGLE_NODE, node, 0, 0, stats);
+    }
+
+    /**
+     * \brief distributes the array block-cyclic on the nodes with threads
+     */
+    int migrate_distributed(size_t stride, struct shl__migrate_stats *stats = NULL)
+    {
+        return replace(SHL_MALLOC_DISTRIBUTED, SHL_NUMA_IGNORE, stride, 0, stats);
+    }
+
+    /**
+     * \brief partitions the array for "schedule(static, chunk)"
+     */
+    int migrate_partitioned(size_t chunk, struct shl__migrate_stats *stats = NULL)
+    {
+        return replace(SHL_MALLOC_PARTITION, SHL_NUMA_IGNORE, 0, chunk, stats);
+    }
+
+    /*
+     * ---------------------------------------------------------------------------
+     * Double buffering
+     * ---------------------------------------------------------------------------
+     */
+
+    /**
+     * \brief exchanges the memory of this array with that of other
+     *
+     * Both arrays must be of the same kind and size, and allocated.
+     * Only pointers are exchanged, so placement moves along with the
+     * contents. Pointers cached by threads (views, shl_rep_thread_ptr)
+     * are stale afterwards, see shl_array_double_buffered::swap.
+     */
+    virtual void swap_memory(shl_array<T> *other)
+    {
+        assert(other->type == shl_base_array::type && other->size == size);
+        assert(alloc_done && other->alloc_done);
+
+        std::swap(array, other->array);
+        std::swap(meminfo, other->meminfo);
+        std::swap(owns_memory, other->owns_memory);
+        std::swap(pagesize, other->pagesize);
+    }
+
     Timer tPrepare;
     Timer tCopy;
     Timer tBarrier;
@@ -493,8 +609,8 @@ class shl_array : public shl_base_array {
      *          non-zero if there was an error
      *
      *
-     * This is useful for example for "double-buffering" for parallel
-     * OpenMP loops.
+     * Iterative loops copying between a current and a next array
+     * should use shl_array_double_buffered instead, which swaps them.
      */
     virtual int copy_from_array_async(shl_array<T> *src_array, size_t elements);
     virtual int copy_from_array(shl_array<T> *src_array);
@@ -510,16 +626,14 @@ class shl_array : public shl_base_array {
     virtual int init_from_value_async(T value, size_t elements);
     virtual int init_from_value(T value)
     {
-        size_t start = (size * ARRAY_COPY_DMA_RATION);
+        size_t start = (size / 100 * dma_fraction);
 
         if ((start > 0) && init_from_value_async(value, start) != 0) {
             start = 0;
         }
 
-        #pragma omp parallel for
-        for (size_t i = start; i < size; ++i) {
-            array[i] = value;
-        }
+        shl__memset_parallel(array + start, &value, sizeof(T),
+                             (size - start) * sizeof(T));
 
         copy_barrier();
         return 0;
@@ -546,10 +660,8 @@ class shl_array : public shl_base_array {
             start = 0;
         }
 
-        #pragma omp parallel for
-        for (size_t i = start; i < size; ++i) {
-            array[i] = src[i];
-        }
+        shl__memcpy_parallel(array + start, src + start,
+                             (size - start) * sizeof(T));
 
         copy_barrier();
 
@@ -571,16 +683,14 @@ class shl_array : public shl_base_array {
             return 0;
         }
 
-        size_t start = (size * ARRAY_COPY_DMA_RATION);
+        size_t start = (size / 100 * dma_fraction);
 
-        if ((start > 0) && copy_back_async(dest, size) != 0) {
+        if ((start > 0) && copy_back_async(dest, start) != 0) {
             start = 0;
         }
 
-        #pragma omp parallel for
-        for (size_t i = start; i < size; ++i) {
-            dest[i] = array[i];
-        }
+        shl__memcpy_parallel(dest + start, array + start,
+                             (size - start) * sizeof(T));
         copy_barrier();
 
         return 0;
@@ -638,7 +748,6 @@ class shl_array : public shl_base_array {
 
  public:
     Timer t_collapse;
-    Timer t_expand[MAXCORES];
 
     virtual void collapse(void)
     {
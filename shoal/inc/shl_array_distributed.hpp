@@ -63,6 +63,15 @@ class shl_array_distributed : public shl_array<T> {
 
     int alloc(void);
 
+    /**
+     * \brief returns the node holding the i-th element
+     *
+     * \param i element index
+     *
+     * \returns node ID, or -1 if the array is not allocated
+     */
+    int get_node(size_t i);
+
     /**
      * \brief
      * @return
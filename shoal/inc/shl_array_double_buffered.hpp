@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2014 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef __SHL_ARRAY_DOUBLE_BUFFERED
+#define __SHL_ARRAY_DOUBLE_BUFFERED
+
+#include "shl.h"
+#include "shl_array.hpp"
+
+/**
+ * \brief Current and next buffer of an iterative algorithm
+ *
+ * Iterations read the current buffer and write the next one. Instead
+ * of copying next to current at the end of every iteration (with
+ * copy_from_array), swap() exchanges their memory.
+ *
+ * Both buffers are arrays of the same kind (see
+ * shl__malloc_double_buffered), so they have identical placement.
+ * cur() and next() always return the same two objects, only the
+ * memory behind them is exchanged, so pointers to the arrays stay
+ * valid across swaps.
+ */
+template<class T>
+class shl_array_double_buffered {
+
+ private:
+    shl_array<T> *buf_cur;
+    shl_array<T> *buf_next;
+
+    shl_array_double_buffered(const shl_array_double_buffered&);
+    shl_array_double_buffered& operator=(const shl_array_double_buffered&);
+
+ public:
+    /**
+     * \brief Combine two arrays of the same kind and size
+     *
+     * Takes ownership of both arrays.
+     */
+    shl_array_double_buffered(shl_array<T> *cur, shl_array<T> *next)
+        : buf_cur(cur), buf_next(next)
+    {
+        assert(cur->type == next->type && cur->get_size() == next->get_size());
+    }
+
+    ~shl_array_double_buffered(void)
+    {
+        delete buf_cur;
+        delete buf_next;
+    }
+
+    /**
+     * \brief Allocate both buffers
+     */
+    int alloc(void)
+    {
+        int err = buf_cur->alloc();
+        if (err) {
+            return err;
+        }
+        return buf_next->alloc();
+    }
+
+    /**
+     * \brief Return the buffer read in the current iteration
+     */
+    shl_array<T>* cur(void)
+    {
+        return buf_cur;
+    }
+
+    /**
+     * \brief Return the buffer written in the current iteration
+     */
+    shl_array<T>* next(void)
+    {
+        return buf_next;
+    }
+
+    /**
+     * \brief Make the next buffer the current one, and vice versa
+     *
+     * Has to be called by all threads of the team, or outside of
+     * parallel regions. Waits for all writes to the next buffer, then
+     * one thread exchanges the pointers, and all threads continue once
+     * it is done.
+     *
+     * Pointers cached by shl_rep_thread_ptr are resolved again on
+     * their next access. Views have to be created again.
+     */
+    void swap(void)
+    {
+#pragma omp barrier
+#pragma omp single
+        {
+            buf_cur->swap_memory(buf_next);
+            shl__rep_epoch_bump();
+        }
+    }
+};
+
+#endif /* __SHL_ARRAY_DOUBLE_BUFFERED */
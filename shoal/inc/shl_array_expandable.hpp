@@ -3,6 +3,7 @@
 
 #include "shl.h"
 #include "shl_timer.hpp"
+#include "shl_per_thread.hpp"
 
 #include <map>
 #include <vector>
@@ -38,7 +39,16 @@ extern "C" {
  *   back to single-threaded
  *
  * In expanded mode, we need to keep track of writes. We do this using write
- * sets.
+ * sets: every thread records the indices it wrote (see shl_write_set),
+ * while the value is only stored in its local replica. collapse()
+ * writes every thread's set back to the master copy and the other
+ * replicas, each thread its own set. Writes in collapsed mode go to the
+ * master copy and are recorded the same way, so expand() only copies
+ * those indices to the replicas. If a write set reaches its size
+ * (WS_BUFFER_SIZE by default), it is written back early.
+ *
+ * All threads have to call expand() and collapse(), and writes have to
+ * go through set, set_cached or shl_rep_thread_ptr to be recorded.
  *
  * We assume that the write sets from individual clients are
  * disjunct. If they are not, the semantics of concurrent writes in
@@ -55,22 +65,17 @@ extern "C" {
 #define debug_printf(x...) void()
 #endif
 
-union counter_element {
-    int counter;
-    char dummy[CACHELINE];
-};
-
 template <class T>
 class shl_array_expandable : public shl_array_replicated<T>
 {
 
 public:
     Timer t_collapse;
-    Timer t_expand[MAXCORES];
+    shl_per_thread<Timer> t_expand;
 
 private:
-    Timer t_write_back[MAXCORES];
-    union counter_element c_write_back[MAXCORES];
+    shl_per_thread<Timer> t_write_back;
+    shl_per_thread<int> c_write_back;
 
     /**
      * \brief Check consistency of arrays
@@ -98,12 +103,59 @@ private:
         return true;
     }
 
+    shl_per_thread<struct shl_write_set> ws;
+
+    /**
+     * \brief Write back write set of a thread to all other copies
+     *
+     * \param src the copy the thread wrote to, i.e. its replica in
+     *     expanded mode, and the master copy in collapsed mode
+     */
+    void ws_write_back(int tid, T *src)
+    {
+        struct shl_write_set &w = ws[tid];
+        if (w.num == 0) {
+            return;
+        }
+
+        t_write_back[tid].start();
+
+        int num_replicas = shl_array_replicated<T>::num_replicas;
+        T **dst = new T*[num_replicas + 1];
+        int num_dst = 0;
+
+        if (src != shl_array<T>::array) {
+            dst[num_dst++] = shl_array<T>::array;
+        }
+        for (int j=0; j<num_replicas; j++) {
+            if (shl_array_replicated<T>::rep_array[j] != src) {
+                dst[num_dst++] = shl_array_replicated<T>::rep_array[j];
+            }
+        }
+
+        for (size_t k=0; k<w.num; k++) {
+            size_t i = w.idx[k];
+            shl__rep_write_all(dst, num_dst, i, src[i]);
+        }
+
+        debug_printf("ws_write_back: thread %d wrote back %zu entries\n",
+                     tid, w.num);
+
+        w.num = 0;
+        delete[] dst;
+
+        t_write_back[tid].stop();
+        c_write_back[tid]++;
+    }
+
     /**
-     * \brief Write back write set of current thread to master copy
+     * \brief Return the copy the calling thread writes to
      */
-    void ws_write_back(void)
+    T* ws_src(void)
     {
-        // Nothing to do here
+        return is_expanded[shl__get_tid()] ?
+            shl_array_replicated<T>::rep_array[shl_array_replicated<T>::rep_id()] :
+            shl_array<T>::array;
     }
 
 // public:
@@ -115,61 +167,58 @@ private:
 
 protected:
 
-    bool is_expanded[MAXCORES];
+    shl_per_thread<bool> is_expanded;
     pthread_barrier_t b;
 
+    void *master_meminfo;   ///< memory information of the master copy
+
 public:
     /**
      * \brief Initialize replicated array
+     *
+     * \param ws_size size of the write set of every thread in bytes
      */
-    shl_array_expandable(size_t s, const char *_name, int (*f_lookup)(void))
+    shl_array_expandable(size_t s, const char *_name, int (*f_lookup)(void),
+                         size_t ws_size = WS_BUFFER_SIZE)
         : shl_array_replicated<T>(s, _name, f_lookup)
     {
+        shl_base_array::type = SHL_A_EXPANDABLE;
+        master_meminfo = NULL;
+        for (int i=0; i<ws.size(); i++) {
+            ws[i].max = std::max((size_t) 1, ws_size / sizeof(size_t));
+        }
         printf("shl_array_expandable: setting %d threads\n", shl__num_threads());
         pthread_barrier_init(&b, NULL, shl__num_threads());
     }
 
+    /**
+     * \brief Expand arrays
+     *
+     * Writes since the last expand (i.e. in collapsed mode) are copied
+     * from the master copy to the replicas, each thread copying its
+     * own. Afterwards, threads read and write their local replica.
+     */
     void expand(void)
     {
-        // static size_t num_expand = 0;
-        // num_expand++;
-
         int tid = shl__get_tid();
-        /*
-
-        //        assert(!is_expanded);
-
-        //        int r = pthread_barrier_wait(&b);
-        //        assert(r==PTHREAD_BARRIER_SERIAL_THREAD || r==0);
 
+        pthread_barrier_wait(&b);
 
-        // Every thread copies their own data
-        if (shl__is_rep_coordinator(tid)) {
-            t_expand[tid].start();
-            asm volatile ("" : : : "memory");
-            printf("Thread %d executes a memcpy for replica %d (w/ timers)\n",
-                   tid, shl__get_rep_id());
-            memcpy((void*)shl_array_replicated<T>::rep_array[shl__get_rep_id()],
-                    (void*)shl_array<T>::array,
-                    shl_array<T>::size*sizeof(T));
-            asm volatile ("" : : : "memory");
-            printf("t_e = %lf\n", t_expand[tid].stop());
-        }
-        //        r = pthread_barrier_wait(&b);
-
+        t_expand[tid].start();
+        ws_write_back(tid, ws_src());
+        t_expand[tid].stop();
 
-        //
+        pthread_barrier_wait(&b);
 
-        */
         is_expanded[tid] = true;
-
-        //        assert(is_expanded);
+        shl__rep_thread_epoch_bump();
     }
 
     /**
      * \brief Collapse arrays
      *
-     * Writes to replicas will be synchronized back to the master copy.
+     * Writes to replicas will be synchronized back to the master copy
+     * and the other replicas, each thread writing back its own.
      *
      * If multiple replicas have been written at the same index i1
      * since the last expand, the value i1' written back to the master
@@ -177,26 +226,39 @@ public:
      */
     void collapse(void)
     {
-        //        assert (is_expanded);
-
-        is_expanded[shl__get_tid()] = false;
+        int tid = shl__get_tid();
+        T *src = ws_src();
 
         pthread_barrier_wait(&b);
 
-        //        assert (!is_expanded);
+        ws_write_back(tid, src);
+
+        is_expanded[tid] = false;
+        shl__rep_thread_epoch_bump();
+
+        pthread_barrier_wait(&b);
     }
 
     /**
      * \brief Allocate both arrays and switch to collapsed mode
      */
-    virtual void alloc(void)
+    virtual int alloc(void)
     {
-        shl_array<T>::alloc(); shl_array<T>::alloc_done = false;
-        shl_array_replicated<T>::alloc();
+        int err = shl_array<T>::alloc();
+        if (err) {
+            return err;
+        }
+        shl_array<T>::alloc_done = false;
+
+        // meminfo is taken over by the replicas
+        master_meminfo = shl_array<T>::meminfo;
+        shl_array<T>::meminfo = NULL;
 
-        for (int i=0; i<MAXCORES; i++) {
+        for (int i=0; i<is_expanded.size(); i++) {
             is_expanded[i] = false;
         }
+
+        return shl_array_replicated<T>::alloc();
     }
 
     /**
@@ -223,41 +285,39 @@ public:
      */
     virtual T get(size_t i)
     {
-        assert (!"We should use the direct implementation now");
         return is_expanded[shl__get_tid()] ? shl_array_replicated<T>::get(i) : shl_array<T>::get(i);
     }
 
     /**
      * \brief Write to array.
      *
+     * Expanded mode: write to the local replica
      * Collapsed mode: write to master-copy
-     *
      */
     virtual void set(size_t i, T v)
     {
-        assert (!"We should use the direct implementation now");
-        if (is_expanded[shl__get_tid()]) {
+        int tid = shl__get_tid();
+
+        if (is_expanded[tid]) {
 
             debug_printf("Setting new idx=%zu old=%d new=%d on thread %d\n",
-                         i, get(i), v, shl__get_tid());
+                         i, get(i), v, tid);
 
-            int rep_id = shl_array_replicated<T>::lookup();
             struct array_cache ac;
-            ac.rid = rep_id;
-            ac.tid = shl__get_tid();
-            /*= {
-                .rid = rep_id,
-                .tid = shl__get_tid()
-            }; */
-            set_cached(i, v, ac );
+            ac.rid = shl_array_replicated<T>::rep_id();
+            ac.tid = tid;
+            set_cached(i, v, ac);
         }
         else {
-            shl_array<T>::set(i, v);
+            shl_array<T>::array[i] = v;
+            if (ws[tid].add(i)) {
+                ws_write_back(tid, shl_array<T>::array);
+            }
         }
     }
 
     /**
-     * \brief Write to the array
+     * \brief Write to the array in expanded mode
      *
      * Guarantees: threads read their own writes
      */
@@ -268,7 +328,75 @@ public:
                      c.rid, c.tid);
 
         shl_array_replicated<T>::rep_array[c.rid][i] = v;
-        shl_array<T>::array[i] = v;
+        if (ws[c.tid].add(i)) {
+            ws_write_back(c.tid, shl_array_replicated<T>::rep_array[c.rid]);
+        }
+    }
+
+    /**
+     * \brief Return the copy a write of the calling thread goes to
+     *
+     * See set_cached
+     */
+    virtual int get_write_set(T **ptrs)
+    {
+        ptrs[0] = ws_src();
+        return 1;
+    }
+
+    virtual struct shl_write_set* get_write_log(void)
+    {
+        return &ws.local();
+    }
+
+    virtual void write_log_full(void)
+    {
+        ws_write_back(shl__get_tid(), ws_src());
+    }
+
+    /**
+     * \brief Initialize all copies from src
+     */
+    virtual int copy_from(T* src)
+    {
+        int err = shl_array_replicated<T>::copy_from(src);
+        if (shl_array<T>::do_copy_in()) {
+            memcpy(shl_array<T>::array, src, shl_array<T>::size * sizeof(T));
+        }
+        return err;
+    }
+
+    /**
+     * \brief Initialize all copies to value
+     */
+    virtual int init_from_value(T value)
+    {
+        int err = shl_array_replicated<T>::init_from_value(value);
+        std::fill(shl_array<T>::array, shl_array<T>::array + shl_array<T>::size, value);
+        return err;
+    }
+
+    /**
+     * \brief Initialize all copies from another array
+     */
+    virtual int copy_from_array(shl_array<T> *src_array)
+    {
+        int err = shl_array_replicated<T>::copy_from_array(src_array);
+        memcpy(shl_array<T>::array, shl_array_replicated<T>::rep_array[0],
+               shl_array<T>::size * sizeof(T));
+        return err;
+    }
+
+    /**
+     * \brief Not supported, write sets refer to the contents
+     */
+    virtual void swap_memory(shl_array<T> *other)
+    {
+        printf(ANSI_COLOR_RED "ERROR: expandable array %s cannot swap memory "
+               "(e.g. for double buffering)\n" ANSI_COLOR_RESET,
+               shl_base_array::name);
+        fflush(stdout);
+        abort();
     }
 
     bool get_expanded(void)
@@ -280,11 +408,14 @@ public:
     {
         pthread_barrier_destroy(&b);
 
+        shl__free(shl_array<T>::array, master_meminfo);
+        shl_array<T>::array = NULL;
+
 #if defined(SHL_DBG_ARR)
         for (int i=0; i<shl__num_threads(); i++) {
 
             printf("destructor %2d: t_write_back %11.6lf - c_write_back % 4d\n",
-                   i, t_write_back[i].get(), c_write_back[i].counter);
+                   i, t_write_back[i].get(), c_write_back[i]);
         }
 #endif /* SHL_DBG_ARR */
     }
@@ -292,7 +423,7 @@ public:
 public:
     virtual unsigned long get_crc(void)
     {
-        return shl_array_replicated<T>::get_crc();
+        return shl_array<T>::get_crc();
     }
 
 protected:
@@ -302,15 +433,14 @@ protected:
         printf("expandable=[X]");
     }
 
-    virtual void copy_back(T* a)
+    virtual int copy_back(T* a)
     {
-        printf("Copy back e/c\n");
+        printf("Copy back e/c (from master copy)\n");
 
-        for (unsigned int i=0; i<shl_array<T>::size; i++) {
-
-            shl_array<T>::array_copy[i] = shl_array_replicated<T>::rep_array[0][i];
-        }
+        // Replicas miss writes since the last expand
+        memcpy(a, shl_array<T>::array, shl_array<T>::size * sizeof(T));
 
+        return 0;
     }
 
     virtual bool do_copy_back(void)
@@ -0,0 +1,424 @@
+/*
+ * Copyright (c) 2014 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef __SHL_ARRAY_OPLOG
+#define __SHL_ARRAY_OPLOG
+
+#include <cstdlib>
+#include <cstring>
+
+#ifndef BARRELFISH
+#include <sched.h>
+#endif
+
+#include "shl.h"
+#include "shl_array_replicated.hpp"
+
+#define SHL_OPLOG_ENTRIES (64*1024)   ///< default number of log entries
+
+/**
+ * \brief Operations recorded in the log of shl_array_oplog
+ */
+enum shl_oplog_op {
+    SHL_OPLOG_SET,      ///< a[i] = v
+    SHL_OPLOG_ADD       ///< a[i] += v
+};
+
+/**
+ * \brief Replicated array updated through an operation log
+ *
+ * Writers do not store to the replicas, but append (index, op, value)
+ * records to a log shared by all replicas. Every replica remembers how
+ * far it has applied the log. Before a read, a thread brings its
+ * replica up to date: one thread per replica (the combiner, holding
+ * the replica's lock) replays the missing records into it, all other
+ * threads of that replica wait for it. Replicas nobody reads from are
+ * not updated until needed.
+ *
+ * So writes cost an atomic increment of the log tail and a store into
+ * the log instead of a store to every replica, and all replicas apply
+ * the same operations in the same order. Threads read their own
+ * writes; reads by others see all writes appended before the read
+ * started.
+ *
+ * If the log is full, writers replay it into the replicas lagging
+ * behind, so that the oldest records can be reused.
+ *
+ * Replicas sharing their memory (see shl__repl_canonical) share the
+ * state of the first of them, so records are applied once.
+ *
+ * SHL_OPLOG_ADD requires T to have an operator+. shl_rep_thread_ptr
+ * cannot be used with these arrays, views forward to get and set.
+ */
+template<class T>
+class shl_array_oplog : public shl_array_replicated<T> {
+
+ private:
+    struct entry {
+        unsigned long seq;      ///< position + 1, once the entry is written
+        size_t idx;
+        T val;
+        int op;
+    };
+
+    struct rep_state {
+        unsigned long applied;  ///< log positions applied to the replica
+        int lock;               ///< held by the combiner of the replica
+    } __attribute__((aligned(CACHELINE)));
+
+    struct counters {
+        unsigned long tail;     ///< next free position of the log
+        unsigned long pad[CACHELINE / sizeof(unsigned long) - 1];
+        unsigned long low;      ///< applied to all replicas (lower bound)
+    };
+
+    struct entry *log;
+    size_t log_size;            ///< number of entries of log
+
+    struct rep_state *state;    ///< indexed by canonical replica
+    int *canon;                 ///< canonical replica of every replica
+
+    struct counters *pos;       ///< written by all threads
+
+    static inline void relax(void)
+    {
+#ifdef BARRELFISH
+        thread_yield();
+#else
+        sched_yield();
+#endif
+    }
+
+    /**
+     * \brief Apply the log up to position target to replica r
+     *
+     * r is a canonical replica, the caller holds its lock.
+     */
+    void replay(int r, unsigned long target)
+    {
+        T *rep = shl_array_replicated<T>::rep_array[r];
+
+        for (unsigned long p = state[r].applied; p < target; p++) {
+
+            struct entry *e = log + p % log_size;
+
+            // The writer may not be done yet
+            while (__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != p + 1) {
+                relax();
+            }
+
+            if (e->op == SHL_OPLOG_ADD) {
+                rep[e->idx] = rep[e->idx] + e->val;
+            } else {
+                rep[e->idx] = e->val;
+            }
+
+            // Writers waiting for log space watch this
+            __atomic_store_n(&state[r].applied, p + 1, __ATOMIC_RELEASE);
+        }
+    }
+
+    /**
+     * \brief Bring canonical replica r up to log position target
+     *
+     * Becomes the combiner of the replica, or waits for it.
+     */
+    void combine(int r, unsigned long target)
+    {
+        while (__atomic_load_n(&state[r].applied, __ATOMIC_ACQUIRE) < target) {
+
+            if (__sync_lock_test_and_set(&state[r].lock, 1) == 0) {
+                replay(r, target);
+                __sync_lock_release(&state[r].lock);
+            } else {
+                relax();
+            }
+        }
+    }
+
+    /**
+     * \brief Wait until the log entry at position p may be reused
+     *
+     * Replicas lagging behind are brought forward by the caller.
+     */
+    void wait_space(unsigned long p)
+    {
+        while (p >= __atomic_load_n(&pos->low, __ATOMIC_ACQUIRE) + log_size) {
+
+            unsigned long target = p + 1 - log_size;
+            unsigned long min = p;
+
+            for (int r = 0; r < shl_array_replicated<T>::num_replicas; r++) {
+
+                if (canon[r] != r) {
+                    continue;
+                }
+
+                if (__atomic_load_n(&state[r].applied, __ATOMIC_ACQUIRE) < target &&
+                    __sync_lock_test_and_set(&state[r].lock, 1) == 0) {
+                    replay(r, target);
+                    __sync_lock_release(&state[r].lock);
+                }
+
+                min = std::min(min, __atomic_load_n(&state[r].applied,
+                                                    __ATOMIC_ACQUIRE));
+            }
+
+            if (min < target) {
+                relax();
+            }
+
+            // Only ever moves forward
+            unsigned long cur = __atomic_load_n(&pos->low, __ATOMIC_ACQUIRE);
+            while (cur < min && !__sync_bool_compare_and_swap(&pos->low, cur, min)) {
+                cur = __atomic_load_n(&pos->low, __ATOMIC_ACQUIRE);
+            }
+        }
+    }
+
+    /**
+     * \brief Mark the log as applied to all replicas
+     *
+     * Used after the replicas have been (re)initialized, so pending
+     * operations are dropped. Must not run concurrently with writers.
+     */
+    void reset_log(void)
+    {
+        for (int r = 0; r < shl_array_replicated<T>::num_replicas; r++) {
+            state[r].applied = pos->tail;
+        }
+        pos->low = pos->tail;
+    }
+
+ public:
+    /**
+     * \brief Initialize operation-log array
+     *
+     * \param entries number of log entries
+     */
+    shl_array_oplog(size_t s, const char *_name, int (*f_lookup)(void),
+                    size_t entries = SHL_OPLOG_ENTRIES)
+        : shl_array_replicated<T>(s, _name, f_lookup)
+    {
+        shl_base_array::type = SHL_A_OPLOG;
+        log = NULL;
+        log_size = entries;
+        state = NULL;
+        canon = NULL;
+        pos = NULL;
+    }
+
+    /**
+     * \brief Allocate replicas and the log
+     */
+    virtual int alloc(void)
+    {
+        int err = shl_array_replicated<T>::alloc();
+        if (err) {
+            return err;
+        }
+
+        void *mem = NULL;
+        err = posix_memalign(&mem, CACHELINE, log_size * sizeof(struct entry));
+        assert(err == 0 && mem != NULL);
+        log = (struct entry*) mem;
+        memset(log, 0, log_size * sizeof(struct entry));
+
+        int num_replicas = shl_array_replicated<T>::num_replicas;
+        err = posix_memalign(&mem, CACHELINE, num_replicas * sizeof(struct rep_state));
+        assert(err == 0 && mem != NULL);
+        state = (struct rep_state*) mem;
+        memset(state, 0, num_replicas * sizeof(struct rep_state));
+
+        err = posix_memalign(&mem, CACHELINE, sizeof(struct counters));
+        assert(err == 0 && mem != NULL);
+        pos = (struct counters*) mem;
+        memset(pos, 0, sizeof(struct counters));
+
+        canon = (int*) malloc(num_replicas * sizeof(int));
+        assert(canon != NULL);
+        for (int r = 0; r < num_replicas; r++) {
+            canon[r] = shl__repl_canonical((void**) shl_array_replicated<T>::rep_array, r);
+        }
+
+        return 0;
+    }
+
+    virtual ~shl_array_oplog(void)
+    {
+        free(log);
+        free(state);
+        free(pos);
+        free(canon);
+    }
+
+    /**
+     * \brief Append an operation on element i to the log
+     */
+    void append(size_t i, T v, enum shl_oplog_op op)
+    {
+#ifdef PROFILE
+        __sync_fetch_and_add(&shl_array<T>::num_wr, 1);
+#endif
+        unsigned long p = __sync_fetch_and_add(&pos->tail, 1);
+
+        wait_space(p);
+
+        struct entry *e = log + p % log_size;
+        e->idx = i;
+        e->val = v;
+        e->op = op;
+        __atomic_store_n(&e->seq, p + 1, __ATOMIC_RELEASE);
+    }
+
+    virtual void set(size_t i, T v)
+    {
+        append(i, v, SHL_OPLOG_SET);
+    }
+
+    /**
+     * \brief Add v to element i
+     */
+    void add(size_t i, T v)
+    {
+        append(i, v, SHL_OPLOG_ADD);
+    }
+
+    /**
+     * \brief Apply all operations appended so far to the replica of
+     * the calling thread
+     *
+     * \returns the replica
+     */
+    inline T* sync(void)
+    {
+        int r = canon[shl_array_replicated<T>::rep_id()];
+        unsigned long t = __atomic_load_n(&pos->tail, __ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(&state[r].applied, __ATOMIC_ACQUIRE) != t) {
+            combine(r, t);
+        }
+
+        return shl_array_replicated<T>::rep_array[r];
+    }
+
+    /**
+     * \brief Apply all operations appended so far to all replicas
+     */
+    void sync_all(void)
+    {
+        unsigned long t = __atomic_load_n(&pos->tail, __ATOMIC_ACQUIRE);
+
+        for (int r = 0; r < shl_array_replicated<T>::num_replicas; r++) {
+            if (canon[r] == r) {
+                combine(r, t);
+            }
+        }
+    }
+
+    virtual T get(size_t i)
+    {
+#ifdef PROFILE
+        __sync_fetch_and_add(&shl_array<T>::num_rd, 1);
+#endif
+        return sync()[i];
+    }
+
+    /**
+     * \brief Return the replica of the calling thread, up to date
+     * with the log
+     *
+     * Writes to this pointer will result in undefined behavior, and
+     * later writes are not reflected before the next call.
+     */
+    virtual T* get_array(void)
+    {
+        return this->alloc_done ? sync() : NULL;
+    }
+
+    /**
+     * \brief Writes only go to the log, see set
+     */
+    virtual int get_write_set(T **ptrs)
+    {
+        assert(!"shl_array_oplog has to be written with set or add");
+        return 0;
+    }
+
+    /**
+     * \brief Exchange replicas and logs with other
+     *
+     * Must not run concurrently with accesses to either array.
+     */
+    virtual void swap_memory(shl_array<T> *other)
+    {
+        shl_array_oplog<T> *o = static_cast<shl_array_oplog<T>*>(other);
+
+        shl_array_replicated<T>::swap_memory(other);
+        std::swap(log, o->log);
+        std::swap(log_size, o->log_size);
+        std::swap(state, o->state);
+        std::swap(canon, o->canon);
+        std::swap(pos, o->pos);
+    }
+
+    virtual int copy_from(T* src)
+    {
+        int err = shl_array_replicated<T>::copy_from(src);
+        reset_log();
+        return err;
+    }
+
+    virtual int init_from_value(T value)
+    {
+        int err = shl_array_replicated<T>::init_from_value(value);
+        reset_log();
+        return err;
+    }
+
+    virtual int copy_from_array(shl_array<T> *src_array)
+    {
+        int err = shl_array_replicated<T>::copy_from_array(src_array);
+        reset_log();
+        return err;
+    }
+
+    virtual unsigned long get_crc(void)
+    {
+        if (shl_array<T>::alloc_done) {
+            sync_all();
+        }
+        return shl_array_replicated<T>::get_crc();
+    }
+
+ protected:
+    virtual void print_options(void)
+    {
+        shl_array<T>::print_options();
+        printf("oplog=[X]");
+    }
+
+    virtual int copy_back(T* a)
+    {
+        printf("Copy back oplog (from copy 0)\n");
+
+        sync_all();
+        memcpy(a, shl_array_replicated<T>::rep_array[0],
+               shl_array<T>::size * sizeof(T));
+
+        return 0;
+    }
+
+    virtual bool do_copy_back(void)
+    {
+        return true;
+    }
+};
+
+#endif /* __SHL_ARRAY_OPLOG */
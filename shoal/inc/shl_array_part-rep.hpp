@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) 2014 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef __SHL_ARRAY_PART_REP
+#define __SHL_ARRAY_PART_REP
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "shl.h"
+#include "shl_array_replicated.hpp"
+
+/**
+ * \brief Replicated array where every replica owns a part
+ *
+ * For owner-computes loops (e.g. pagerank), where the threads of a
+ * node write the elements they are assigned by the static schedule
+ * (as for partitioned arrays, see shl__malloc_partitioned), but read
+ * all elements. Every element is owned by the replica of the thread
+ * executing its iteration under "schedule(static, chunk)" with
+ * shl__num_threads() threads. With chunk 0 ("schedule(static)"), these
+ * are contiguous slices.
+ *
+ * Threads write only the replica of their static placement (see
+ * shl__lookup_rep_id), and only elements it owns; reads go to their
+ * current replica. Other replicas see these writes after
+ * the next exchange(), which copies the parts written since the last
+ * one from their owner to all other replicas. It is called between
+ * parallel loops, as an explicit synchronization point.
+ *
+ * Writes through set() or a view mark the written block as dirty.
+ * Writes through shl_rep_thread_ptr are not tracked, so the next
+ * exchange copies all parts.
+ */
+template<class T>
+class shl_array_part_rep : public shl_array_replicated<T> {
+
+ private:
+    std::vector<struct shl__range> parts;   ///< in bytes
+    std::vector<int> part_rep;              ///< owner of every part
+
+    bool *dirty;        ///< per block of elements
+    size_t block;       ///< elements per block
+    size_t num_blocks;
+    bool all_dirty;     ///< writes not tracked in dirty
+    size_t chunk;       ///< chunk size of the static schedule, 0 for none
+
+    /**
+     * \brief Determine the parts owned by every replica
+     */
+    void build_parts(void)
+    {
+        size_t n = shl_array<T>::size;
+        size_t nt = shl__num_threads();
+
+        size_t i = 0;
+        while (i < n) {
+
+            size_t tid = shl__static_schedule_owner(i, n, chunk, nt);
+
+            // Thread blocks of schedule(static) are contiguous
+            size_t end;
+            if (chunk) {
+                end = std::min(n, (i / chunk + 1) * chunk);
+            } else {
+                size_t lo = i, hi = n;
+                while (hi - lo > 1) {
+                    size_t mid = lo + (hi - lo) / 2;
+                    if (shl__static_schedule_owner(mid, n, chunk, nt) == tid)
+                        lo = mid;
+                    else
+                        hi = mid;
+                }
+                end = hi;
+            }
+
+            int rep = shl__lookup_rep_id(tid);
+            if (!part_rep.empty() && part_rep.back() == rep) {
+                parts.back().size += (end - i) * sizeof(T);
+            } else {
+                struct shl__range r = { i * sizeof(T), (end - i) * sizeof(T) };
+                parts.push_back(r);
+                part_rep.push_back(rep);
+            }
+
+            i = end;
+        }
+    }
+
+    /**
+     * \brief Return the replica owning the writes of the calling thread
+     *
+     * This is the static replica of the thread (as in build_parts),
+     * not its current one, which differs e.g. with dynamic lookups.
+     */
+    inline int owner_rep(void)
+    {
+        int tid = shl__get_tid();
+        if (tid >= shl__num_threads()) {
+            printf(ANSI_COLOR_RED "ERROR: part_rep array %s written by thread "
+                   "%d, but owners are threads 0..%d (see shl__init)\n"
+                   ANSI_COLOR_RESET, shl_base_array::name, tid,
+                   shl__num_threads() - 1);
+            fflush(stdout);
+            abort();
+        }
+        return shl__lookup_rep_id(tid);
+    }
+
+    inline void mark(size_t i)
+    {
+        bool *d = dirty + i / block;
+        if (!*d)
+            *d = true;
+    }
+
+ public:
+    /**
+     * \brief Initialize partitioned-replicated array
+     *
+     * \param _chunk chunk size of the static schedule of the loops
+     *     writing the array, 0 for "schedule(static)"
+     */
+    shl_array_part_rep(size_t s, const char *_name, int (*f_lookup)(void),
+                       size_t _chunk = 0)
+        : shl_array_replicated<T>(s, _name, f_lookup)
+    {
+        shl_base_array::type = SHL_A_PART_REPLICATED;
+        dirty = NULL;
+        block = std::max((size_t) 1, PAGESIZE / sizeof(T));
+        num_blocks = 0;
+        all_dirty = false;
+        chunk = _chunk;
+    }
+
+    /**
+     * \brief Allocate one replica per replica node
+     */
+    virtual int alloc(void)
+    {
+        int err = shl_array_replicated<T>::alloc();
+        if (err) {
+            return err;
+        }
+
+        build_parts();
+
+        num_blocks = (shl_array<T>::size + block - 1) / block;
+        dirty = (bool*) calloc(num_blocks ? num_blocks : 1, sizeof(bool));
+        assert(dirty != NULL);
+
+        return 0;
+    }
+
+    virtual ~shl_array_part_rep(void)
+    {
+        free(dirty);
+    }
+
+    /**
+     * \brief Write to the replica owning i
+     *
+     * i has to be owned by the replica of the calling thread (see
+     * owner_rep), so only the first shl__num_threads() threads may
+     * write.
+     */
+    virtual void set(size_t i, T v)
+    {
+#ifdef PROFILE
+        __sync_fetch_and_add(&shl_array<T>::num_wr, 1);
+#endif
+        shl_array_replicated<T>::rep_array[owner_rep()][i] = v;
+        mark(i);
+    }
+
+    /**
+     * \brief Writes go to the owning replica of the calling thread only
+     */
+    virtual int get_write_set(T **ptrs)
+    {
+        all_dirty = true;
+        ptrs[0] = shl_array_replicated<T>::rep_array[owner_rep()];
+        return 1;
+    }
+
+    /**
+     * \brief Copy parts written since the last exchange from their
+     * owner to all other replicas
+     *
+     * Must not run concurrently with writes, i.e. is called outside
+     * of parallel regions.
+     */
+    void exchange(void)
+    {
+        assert(shl_array<T>::alloc_done);
+
+        std::vector<struct shl__range> runs;
+        std::vector<int> owner;
+
+        size_t bytes = block * sizeof(T);
+        for (size_t p=0; p<parts.size(); p++) {
+
+            size_t start = parts[p].offset;
+            size_t end = start + parts[p].size;
+
+            // Dirty blocks overlapping the part, merged
+            for (size_t b=start/bytes; b*bytes<end; b++) {
+
+                if (!all_dirty && !dirty[b])
+                    continue;
+
+                size_t from = std::max(start, b*bytes);
+                size_t to = std::min(end, (b+1)*bytes);
+
+                if (!runs.empty() && owner.back() == part_rep[p] &&
+                    runs.back().offset + runs.back().size == from) {
+                    runs.back().size += to - from;
+                } else {
+                    struct shl__range r = { from, to - from };
+                    runs.push_back(r);
+                    owner.push_back(part_rep[p]);
+                }
+            }
+        }
+
+        if (!runs.empty()) {
+            shl__repl_exchange((void**) shl_array_replicated<T>::rep_array,
+                               shl_array_replicated<T>::num_replicas,
+                               shl_array_replicated<T>::domain,
+                               &runs[0], &owner[0], runs.size());
+        }
+
+        memset(dirty, 0, num_blocks * sizeof(bool));
+        all_dirty = false;
+    }
+
+    /**
+     * \brief Exchange replicas with other, along with their ownership
+     * and dirty blocks
+     */
+    virtual void swap_memory(shl_array<T> *other)
+    {
+        shl_array_part_rep<T> *o = static_cast<shl_array_part_rep<T>*>(other);
+
+        shl_array_replicated<T>::swap_memory(other);
+        parts.swap(o->parts);
+        part_rep.swap(o->part_rep);
+        std::swap(chunk, o->chunk);
+        std::swap(dirty, o->dirty);
+        std::swap(num_blocks, o->num_blocks);
+        std::swap(all_dirty, o->all_dirty);
+    }
+
+    virtual unsigned long get_crc(void)
+    {
+        if (shl_array<T>::alloc_done) {
+            exchange();
+        }
+        return shl_array_replicated<T>::get_crc();
+    }
+
+ protected:
+    virtual void print_options(void)
+    {
+        shl_array<T>::print_options();
+        printf("part_rep=[X]");
+    }
+
+    /**
+     * \brief Copy every part from its owner
+     */
+    virtual int copy_back(T* a)
+    {
+        printf("Copy back part_rep (from owners)\n");
+
+        for (size_t p=0; p<parts.size(); p++) {
+            memcpy((char*) a + parts[p].offset,
+                   (char*) shl_array_replicated<T>::rep_array[part_rep[p]] + parts[p].offset,
+                   parts[p].size);
+        }
+
+        return 0;
+    }
+
+    virtual bool do_copy_back(void)
+    {
+        return true;
+    }
+};
+
+#endif /* __SHL_ARRAY_PART_REP */
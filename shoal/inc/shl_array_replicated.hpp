@@ -13,6 +13,7 @@
 #include <cstdlib>
 #include <cstdarg>
 #include <cstring> // memset
+#include <algorithm>
 #include <iostream>
 #include <limits>
 
@@ -20,6 +21,105 @@
 #include "shl_timer.hpp"
 #include "shl_configuration.hpp"
 
+/**
+ * \brief Write a value to N replicas
+ *
+ * The recursion is resolved at compile time, so a write becomes N
+ * stores without a loop. N = 0 is the generic variant, looping over a
+ * number of replicas only known at run time.
+ */
+template <class T, int N>
+struct shl_rep_write {
+    static inline void set(T * const *replicas, int num, size_t i, T v)
+    {
+        shl_rep_write<T, N-1>::set(replicas, num, i, v);
+        replicas[N-1][i] = v;
+    }
+};
+
+template <class T>
+struct shl_rep_write<T, 1> {
+    static inline void set(T * const *replicas, int num, size_t i, T v)
+    {
+        replicas[0][i] = v;
+    }
+};
+
+template <class T>
+struct shl_rep_write<T, 0> {
+    static inline void set(T * const *replicas, int num, size_t i, T v)
+    {
+        for (int r = 0; r < num; r++)
+            replicas[r][i] = v;
+    }
+};
+
+/**
+ * \brief Write a value to all replicas, unrolled for up to 8
+ * replicas
+ *
+ * The switch is well predicted, but prevents vectorization. Hot loops
+ * should use a view (see shl__view_dispatch), which selects the
+ * unrolled variant once.
+ */
+template <class T>
+static inline void shl__rep_write_all(T * const *replicas, int num, size_t i, T v)
+{
+    switch (num) {
+    case 1: shl_rep_write<T, 1>::set(replicas, num, i, v); break;
+    case 2: shl_rep_write<T, 2>::set(replicas, num, i, v); break;
+    case 3: shl_rep_write<T, 3>::set(replicas, num, i, v); break;
+    case 4: shl_rep_write<T, 4>::set(replicas, num, i, v); break;
+    case 5: shl_rep_write<T, 5>::set(replicas, num, i, v); break;
+    case 6: shl_rep_write<T, 6>::set(replicas, num, i, v); break;
+    case 7: shl_rep_write<T, 7>::set(replicas, num, i, v); break;
+    case 8: shl_rep_write<T, 8>::set(replicas, num, i, v); break;
+    default: shl_rep_write<T, 0>::set(replicas, num, i, v); break;
+    }
+}
+
+/**
+ * \brief Indices a thread wrote to since the last write back
+ *
+ * The buffer grows on demand up to max entries. Writing the same index
+ * several times in a row is recorded once.
+ */
+struct shl_write_set {
+    size_t *idx;
+    size_t num;     ///< number of recorded indices
+    size_t cap;     ///< entries allocated
+    size_t max;     ///< entries before the set has to be written back
+
+    shl_write_set(void) : idx(NULL), num(0), cap(0), max(0)
+    {
+    }
+
+    ~shl_write_set(void)
+    {
+        free(idx);
+    }
+
+    /**
+     * \brief Record a write
+     *
+     * \returns true if the set is full and has to be written back
+     */
+    inline bool add(size_t i)
+    {
+        if (num > 0 && idx[num-1] == i)
+            return false;
+
+        if (num == cap) {
+            cap = cap ? std::min(2 * cap, max) : std::min((size_t) 1024, max);
+            idx = (size_t*) realloc(idx, cap * sizeof(size_t));
+            assert(idx != NULL);
+        }
+
+        idx[num++] = i;
+        return num == max;
+    }
+};
+
 /**
  * \brief Array implementing replication
  *
@@ -31,6 +131,7 @@ class shl_array_replicated : public shl_array<T> {
 
 private:
     T* master_copy;
+    struct shl__dirty_region *master_dirty;     ///< tracking of master_copy
 
  public:
     T** rep_array;      ///<
@@ -38,6 +139,7 @@ private:
 
  protected:
     int num_replicas;
+    struct shl_rep_domain *domain;  ///< replication domain, NULL for nodes
 
 
  public:
@@ -54,8 +156,10 @@ private:
         shl_array<T>::read_only = true;
         lookup = lookup_fn;
         master_copy = NULL;
+        master_dirty = NULL;
         num_replicas = -1;
         rep_array = NULL;
+        domain = NULL;
     }
 
     /**
@@ -77,8 +181,10 @@ private:
         shl_array<T>::read_only = true;
         lookup = lookup_fn;
         master_copy = NULL;
+        master_dirty = NULL;
         num_replicas = -1;
         rep_array = NULL;
+        domain = NULL;
     }
 
     /**
@@ -86,6 +192,28 @@ private:
      */
     virtual int alloc(void);
 
+    /**
+     * \brief Replicate per domain (e.g. shl__rep_domain_llc) instead
+     * of per node
+     *
+     * Has to be called before alloc. The domain must outlive the array.
+     * Expandable and write-replicated arrays keep a replica per node,
+     * as their replicas are maintained by the replica coordinators.
+     */
+    void set_domain(struct shl_rep_domain *d)
+    {
+        assert(!this->alloc_done && this->type == SHL_A_REPLICATED);
+        domain = d;
+    }
+
+    /**
+     * \brief Return the replica of the calling thread
+     */
+    inline int rep_id(void)
+    {
+        return domain ? shl__rep_domain_lookup(domain) : lookup();
+    }
+
     /**
      * \brief Optimized method for copying data between two arrays
      *
@@ -95,8 +223,8 @@ private:
      *          non-zero if there was an error
      *
      *
-     * This is useful for example for "double-buffering" for parallel
-     * OpenMP loops.
+     * Iterative loops copying between a current and a next array
+     * should use shl_array_double_buffered instead, which swaps them.
      */
     int copy_from_array_async(shl_array<T> *src_array, size_t elements);
     int copy_from_array(shl_array<T> *src_array)
@@ -104,19 +232,16 @@ private:
         size_t elements = (src_array->get_size() > this->size)
                                         ? this->size : src_array->get_size();
 
-        size_t start = (elements * ARRAY_COPY_DMA_RATION);
+        size_t start = (elements / 100 * this->dma_fraction);
 
         if (copy_from_array_async(src_array, start) != 0) {
             start = 0;
         }
 
-        T* src = src_array->get_array();
-        #pragma omp parallel for
-        for (size_t i = start; i < elements; ++i) {
-            for (int j = 0; j < num_replicas; j++) {
-                rep_array[j][i] = src[i];
-            }
-        }
+        struct fill_arg arg = { src_array->get_array(), stream(elements) };
+        shl__repl_fill((void**) rep_array, num_replicas, start * sizeof(T),
+                       (elements - start) * sizeof(T), sizeof(T),
+                       fill_copy, &arg, domain);
 
         this->copy_barrier();
 
@@ -134,18 +259,16 @@ private:
     int init_from_value_async(T value, size_t elements);
     int init_from_value(T value)
     {
-        size_t start = (this->size * ARRAY_COPY_DMA_RATION);
+        size_t start = (this->size / 100 * this->dma_fraction);
 
         if (init_from_value_async(value, start) != 0) {
             start = 0;
         }
 
-        #pragma omp parallel for
-        for (size_t i = start; i < this->size; ++i) {
-            for (int j = 0; j < num_replicas; j++) {
-                rep_array[j][i] = value;
-            }
-        }
+        struct fill_arg arg = { &value, stream(this->size) };
+        shl__repl_fill((void**) rep_array, num_replicas, start * sizeof(T),
+                       (this->size - start) * sizeof(T), sizeof(T),
+                       fill_value, &arg, domain);
 
         this->copy_barrier();
         return 0;
@@ -172,15 +295,15 @@ private:
             start = 0;
         }
 
-        #pragma omp parallel for
-        for (size_t i = start; i < this->size; ++i) {
-            for (int j = 0; j < num_replicas; j++) {
-                rep_array[j][i] = src[i];
-            }
-        }
+        struct fill_arg arg = { src, stream(this->size) };
+        shl__repl_fill((void**) rep_array, num_replicas, start * sizeof(T),
+                       (this->size - start) * sizeof(T), sizeof(T),
+                       fill_copy, &arg, domain);
 
         this->copy_barrier();
 
+        set_master_copy(src);
+
         return 0;
     }
 
@@ -201,6 +324,14 @@ private:
         return 0;
     }
 
+    /**
+     * \brief Return the number of entries of rep_array
+     */
+    int get_num_replicas(void)
+    {
+        return num_replicas;
+    }
+
     /**
      * \brief Return pointer to beginning of replica
      */
@@ -210,7 +341,7 @@ private:
         printf("Getting pointer for array [%s]\n", shl_base_array::name);
 #endif
         if (this->alloc_done) {
-            return rep_array[lookup()];
+            return rep_array[rep_id()];
         } else {
             return NULL;
         }
@@ -221,7 +352,23 @@ private:
 #ifdef PROFILE
         __sync_fetch_and_add(&shl_array<T>::num_rd, 1);
 #endif
-        return rep_array[lookup()][i];
+        return rep_array[rep_id()][i];
+    }
+
+    /**
+     * \brief Return the copies a write of the calling thread goes to
+     *
+     * \param ptrs returns the copies, has to hold get_num_replicas()+1
+     *     entries
+     *
+     * \returns the number of copies
+     */
+    virtual int get_write_set(T **ptrs)
+    {
+        for (int j = 0; j < num_replicas; j++)
+            ptrs[j] = rep_array[j];
+
+        return num_replicas;
     }
 
     virtual void set(size_t i, T v)
@@ -229,25 +376,90 @@ private:
 #ifdef PROFILE
         __sync_fetch_and_add(&shl_array<T>::num_wr, 1);
 #endif
-        for (int j = 0; j < num_replicas; j++)
-            rep_array[j][i] = v;
+        shl__rep_write_all(rep_array, num_replicas, i, v);
+    }
+
+    /**
+     * \brief Return the write set writes of the calling thread have to
+     * be recorded in, or NULL if they need not be recorded
+     *
+     * See shl_array_expandable.
+     */
+    virtual struct shl_write_set* get_write_log(void)
+    {
+        return NULL;
+    }
+
+    /**
+     * \brief Called when the write set of the calling thread is full
+     */
+    virtual void write_log_full(void)
+    {
     }
 
     virtual ~shl_array_replicated(void)
     {
-        // // Free replicas
-        // for (int i=0; i<num_replicas; i++) {
-        //     free(rep_array[i]);
-        // }
-        // // Clean up meta-data
-        // delete rep_array;
+        set_master_copy(NULL);
+
+        if (this->owns_memory) {
+            shl__free_replicated((void**) rep_array, this->meminfo);
+        }
+
+        // The memory information describes the replicas, so the
+        // base class must not free it again
+        rep_array = NULL;
+        this->meminfo = NULL;
+        this->owns_memory = false;
     }
 
+    /**
+     * \brief Propagate changes of the master copy to all replicas
+     *
+     * The master copy is the array last given to copy_from. It has to
+     * outlive the array or be detached first (see detach_master_copy).
+     * With dirty tracking, only pages written since the last copy_from
+     * or synchronize are copied.
+     */
     void synchronize(void)
     {
         assert(shl_array<T>::alloc_done);
-        shl__repl_sync(master_copy, (void**) rep_array, num_replicas,
-                       shl_array<T>::size * sizeof(T));
+
+        if (master_copy == NULL) {
+            return;
+        }
+
+        shl__repl_sync(master_copy, master_dirty, (void**) rep_array,
+                       num_replicas, shl_array<T>::size * sizeof(T), domain);
+    }
+
+    /**
+     * \brief Forget the master copy
+     *
+     * With dirty tracking, the master copy is write-protected until it
+     * is detached, i.e. it has to stay allocated until this is called
+     * or the array is deleted. synchronize() does nothing afterwards.
+     */
+    void detach_master_copy(void)
+    {
+        set_master_copy(NULL);
+    }
+
+    /**
+     * \brief Exchange the replicas with those of other
+     *
+     * Master copies given to copy_from no longer match the replicas,
+     * so both arrays forget them.
+     */
+    virtual void swap_memory(shl_array<T> *other)
+    {
+        shl_array_replicated<T> *o = static_cast<shl_array_replicated<T>*>(other);
+        assert(o->domain == domain && o->num_replicas == num_replicas);
+
+        shl_array<T>::swap_memory(other);
+        std::swap(rep_array, o->rep_array);
+
+        set_master_copy(NULL);
+        o->set_master_copy(NULL);
     }
 
  protected:
@@ -257,6 +469,58 @@ private:
         printf("replication=[X]");
     }
 
+    /**
+     * \brief Make src the master copy, tracking writes to it
+     *
+     * Replicas are assumed to be identical to src.
+     */
+    void set_master_copy(T *src)
+    {
+        shl__dirty_untrack(master_dirty);
+        master_dirty = NULL;
+
+        master_copy = src;
+
+        if (src && get_conf()->use_dirty_tracking) {
+            master_dirty = shl__dirty_track(src, shl_array<T>::size * sizeof(T));
+        }
+    }
+
+    /**
+     * \brief argument of the shl__repl_fill callbacks
+     */
+    struct fill_arg {
+        const void *src;    ///< source array or value
+        bool stream;        ///< bypass the cache
+    };
+
+    /**
+     * \brief whether filling the given number of elements in all
+     * replicas should bypass the cache
+     */
+    bool stream(size_t elements)
+    {
+        return elements * sizeof(T) * num_replicas >= SHL_STREAM_THRESHOLD;
+    }
+
+    /**
+     * \brief shl__repl_fill callback copying from the source array
+     */
+    static void fill_copy(void *dst, size_t offset, size_t size, void *arg)
+    {
+        struct fill_arg *a = (struct fill_arg*) arg;
+        shl__memcpy_simd(dst, (const char*) a->src + offset, size, a->stream);
+    }
+
+    /**
+     * \brief shl__repl_fill callback writing a single value
+     */
+    static void fill_value(void *dst, size_t offset, size_t size, void *arg)
+    {
+        struct fill_arg *a = (struct fill_arg*) arg;
+        shl__memset_simd(dst, a->src, sizeof(T), size, a->stream);
+    }
+
     virtual void dump(void)
     {
         for (int j = 0; j < num_replicas; j++) {
@@ -296,6 +560,97 @@ private:
 
 };
 
+/**
+ * \brief Per-thread cache of the replica pointers of an array
+ *
+ * Works for all replicated arrays (replicated, expandable, wr-rep)
+ * and any number of replicas. Each thread
+ * creates its own instance, which resolves the pointers the thread
+ * reads and writes on creation. Reads then cost a comparison with
+ * shl__rep_epoch() and a load, instead of a replica lookup.
+ *
+ * Pointers are resolved again on the first access after
+ * shl__rep_epoch_bump(), or shl__rep_thread_epoch_bump() on the same
+ * thread.
+ */
+template <class T>
+class shl_rep_thread_ptr {
+
+private:
+    shl_array_replicated<T> *array;
+    unsigned long epoch;    ///< shl__rep_epoch() the pointers were resolved in
+    int rid;                ///< replica the pointers were resolved for
+    T *rd;                  ///< copy to read from
+    T **wr;                 ///< copies to write to
+    int num_wr;
+    struct shl_write_set *log;  ///< where writes are recorded, or NULL
+
+    shl_rep_thread_ptr(const shl_rep_thread_ptr&);
+    shl_rep_thread_ptr& operator=(const shl_rep_thread_ptr&);
+
+    void refresh(void)
+    {
+        epoch = shl__rep_epoch();
+        rid = array->rep_id();
+        rd = array->get_array();
+        num_wr = array->get_write_set(wr);
+        log = array->get_write_log();
+    }
+
+public:
+    explicit shl_rep_thread_ptr(shl_array_replicated<T> *a)
+        : array(a)
+    {
+        wr = new T*[a->get_num_replicas() + 1];
+        refresh();
+    }
+
+    ~shl_rep_thread_ptr(void)
+    {
+        delete[] wr;
+    }
+
+    /**
+     * \brief Resolve the pointers again if the thread moved to another
+     * replica
+     *
+     * Only needed with dynamic replica lookup, where threads are not
+     * pinned. Call once per batch of accesses to keep reads local.
+     */
+    inline void revalidate(void)
+    {
+        if (epoch != shl__rep_epoch() || array->rep_id() != rid)
+            refresh();
+    }
+
+    inline T get(size_t i)
+    {
+        if (epoch != shl__rep_epoch())
+            refresh();
+
+        return rd[i];
+    }
+
+    inline void set(size_t i, T v)
+    {
+        if (epoch != shl__rep_epoch())
+            refresh();
+
+        shl__rep_write_all(wr, num_wr, i, v);
+
+        if (log && log->add(i))
+            array->write_log_full();
+    }
+
+    inline T* get_array(void)
+    {
+        if (epoch != shl__rep_epoch())
+            refresh();
+
+        return rd;
+    }
+};
+
 /// include backend specific functions
 #if defined(BARRELFISH)
 #include <backend/barrelfish/shl_array_replicated_backend.hpp>
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2014 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef __SHL_ARRAY_VIEW
+#define __SHL_ARRAY_VIEW
+
+#include "shl_array.hpp"
+#include "shl_array_replicated.hpp"
+
+/*
+ * Statically dispatched array access
+ *
+ * shl_array<T> and its subclasses use virtual accessors, and
+ * replicated arrays look up the replica on every read. Neither can be
+ * inlined into a loop. Views are small non-virtual classes that
+ * resolve all of this once, when they are created, so that get/set
+ * compile down to a plain load or store.
+ *
+ * A view is created for one array per thread and loop, from the
+ * shl_array<T>* handed out by shl__malloc_array:
+ *
+ *     struct body {
+ *         template <class V> void operator()(V &a) {
+ *             #pragma omp for
+ *             for (size_t i=0; i<n; i++) sum += a.get(i);
+ *         }
+ *     };
+ *
+ *     #pragma omp parallel
+ *     {
+ *         body b;
+ *         shl__view_dispatch(arr, b);
+ *     }
+ *
+ * Views must not outlive the array, and must be created again after
+ * the array has been re-allocated or migrated.
+ */
+
+/**
+ * \brief View of an array that has a single copy
+ *
+ * Used for single-node, distributed and partitioned arrays.
+ */
+template<class T>
+class shl_view_direct {
+ private:
+    T *array;
+
+ public:
+    explicit shl_view_direct(shl_array<T> *a) :
+        array(a->get_array())
+    {
+    }
+
+    inline T get(size_t i) const
+    {
+        return array[i];
+    }
+
+    inline void set(size_t i, T v) const
+    {
+        array[i] = v;
+    }
+
+    inline T* get_array(void) const
+    {
+        return array;
+    }
+};
+
+/**
+ * \brief View of a replicated array
+ *
+ * Reads go to the replica of the thread creating the view, writes to
+ * all replicas. Writes are unrolled for N replicas, N = 0 loops over
+ * any number of replicas.
+ */
+template<class T, int N>
+class shl_view_replicated {
+ private:
+    T *local;               ///< replica of the thread, for reads
+    T **replicas;           ///< all replicas, for writes
+    int num_replicas;
+
+ public:
+    explicit shl_view_replicated(shl_array_replicated<T> *a) :
+        local(a->rep_array[a->rep_id()]),
+        replicas(a->rep_array),
+        num_replicas(a->get_num_replicas())
+    {
+    }
+
+    inline T get(size_t i) const
+    {
+        return local[i];
+    }
+
+    inline void set(size_t i, T v) const
+    {
+        shl_rep_write<T, N>::set(replicas, num_replicas, i, v);
+    }
+
+    inline T* get_array(void) const
+    {
+        return local;
+    }
+};
+
+/**
+ * \brief View forwarding to the virtual accessors
+ *
+ * Used for arrays whose accessors depend on run-time state, i.e.
+ * expandable, operation-log and partitioned-replicated arrays.
+ */
+template<class T>
+class shl_view_virtual {
+ private:
+    shl_array<T> *array;
+
+ public:
+    explicit shl_view_virtual(shl_array<T> *a) :
+        array(a)
+    {
+    }
+
+    inline T get(size_t i) const
+    {
+        return array->get(i);
+    }
+
+    inline void set(size_t i, T v) const
+    {
+        array->set(i, v);
+    }
+
+    inline T* get_array(void) const
+    {
+        return array->get_array();
+    }
+};
+
+/**
+ * \brief Call f with the view of a replicated array, unrolled for its
+ * number of replicas
+ */
+template<class T, class F>
+void shl__view_dispatch_replicated(shl_array_replicated<T> *a, F &f)
+{
+    switch (a->get_num_replicas()) {
+#define SHL_VIEW_REPLICATED_CASE(n)                 \
+    case n:                                         \
+        {                                           \
+            shl_view_replicated<T, n> v(a);         \
+            f(v);                                   \
+        }                                           \
+        break;
+    SHL_VIEW_REPLICATED_CASE(1)
+    SHL_VIEW_REPLICATED_CASE(2)
+    SHL_VIEW_REPLICATED_CASE(3)
+    SHL_VIEW_REPLICATED_CASE(4)
+    SHL_VIEW_REPLICATED_CASE(5)
+    SHL_VIEW_REPLICATED_CASE(6)
+    SHL_VIEW_REPLICATED_CASE(7)
+    SHL_VIEW_REPLICATED_CASE(8)
+#undef SHL_VIEW_REPLICATED_CASE
+    default:
+        {
+            shl_view_replicated<T, 0> v(a);
+            f(v);
+        }
+        break;
+    }
+}
+
+/**
+ * \brief Call f with the view matching the array
+ *
+ * f is a function object with a templated operator() taking the view
+ * by reference. It is instantiated for every kind of view; the type
+ * of the array is inspected once per call only.
+ */
+template<class T, class F>
+void shl__view_dispatch(shl_array<T> *a, F &f)
+{
+    switch (a->type) {
+    case SHL_A_REPLICATED:
+    case SHL_A_WR_REPLICATED:
+        shl__view_dispatch_replicated(static_cast<shl_array_replicated<T>*>(a), f);
+        break;
+    case SHL_A_EXPANDABLE:
+    case SHL_A_OPLOG:
+    case SHL_A_PART_REPLICATED:
+        {
+            shl_view_virtual<T> v(a);
+            f(v);
+        }
+        break;
+    default:
+        {
+            shl_view_direct<T> v(a);
+            f(v);
+        }
+        break;
+    }
+}
+
+#endif /* __SHL_ARRAY_VIEW */
@@ -17,6 +17,10 @@
 #include "shl_array_expandable.hpp"
 #include "shl_array_single_node.hpp"
 #include "shl_array_wr-rep.hpp"
+#include "shl_array_oplog.hpp"
+#include "shl_array_part-rep.hpp"
+#include "shl_array_double_buffered.hpp"
+#include "shl_array_view.hpp"
 
 #include "shl_alloc.hpp"
 
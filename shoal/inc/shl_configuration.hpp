@@ -22,6 +22,7 @@ class Configuration {
     ~Configuration(void) {
 
         free (node_mem_avail);
+        free (node_mem_committed);
     }
 
     // Should huge pages be used
@@ -50,17 +51,59 @@ class Configuration {
     // How much memory is available on each node
     long* node_mem_avail;
 
+    // How much memory arrays hold on each node; the extra last entry
+    // counts memory of unknown placement
+    long* node_mem_committed;
+
+    // Downgrade the placement of arrays that do not fit
+    bool use_admission;
+
+    // Determine the replica of a thread from the CPU it currently runs
+    // on, rather than from the CPU it was pinned to
+    bool use_dynamic_lookup;
+
+    // Choose thread count and placement if SHL_CPU_AFFINITY is not
+    // given: 0 off, 1 heuristic, 2 heuristic and probe
+    int auto_tune;
+
+    // Whether the program synchronizes with barriers, i.e. should not
+    // run two threads on one core
+    bool auto_tune_barriers;
+
+    // Fill nodes (1) or spread over nodes (0), -1 to decide by probe
+    int auto_tune_fill;
+
     // Number of threads
     size_t num_threads;
 
+    // Number of thread ids (OpenMP threads and registered threads),
+    // i.e. the size of per-thread state
+    size_t max_threads;
+
     // NUMA trim
     // Use this to instruct the runtime to not replica on all n NUMA nodes,
     // but only n/trim_factor ones.
     int numa_trim;
 
+    // Number of replicas, 0 for n/trim_factor. Replicas are placed
+    // by distance (see shl__rep_map_init).
+    int num_replicas;
+
     // stride for mapping distributed
     size_t stride;
 
+    // chunk size of the OpenMP static schedule used for partitioned
+    // arrays (0 for a plain static schedule without chunk size)
+    size_t chunk;
+
+    // track writes to the master copy of replicated arrays, so that
+    // synchronize only copies pages that changed
+    bool use_dirty_tracking;
+
+    // bytes of released mappings kept for reuse by arrays allocated
+    // with SHL_MALLOC_POOLED
+    size_t pool_size;
+
     /* */
     bool use_dma;
 
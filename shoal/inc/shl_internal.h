@@ -17,7 +17,7 @@ struct shl__pci_address {
  * \brief setup information structure for initializing the memcpy facility
  */
 struct shl__memcpy_setup {
-    uint32_t count;             ///< the number of devices
+    uint32_t count;             ///< the number of devices (Linux: copy threads per node)
     struct shl__pci_address *pci;
     struct {
         uint32_t vendor;    ///< the vendor of the device
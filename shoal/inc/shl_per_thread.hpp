@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2014 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef __SHL_PER_THREAD
+#define __SHL_PER_THREAD
+
+#include <cstdlib>
+#include <new>
+
+#include "shl.h"
+
+/**
+ * \brief One instance of T per thread id
+ *
+ * Sized from shl__max_threads(), so it has to be created after
+ * shl__init. Every slot starts on its own cacheline, so threads
+ * updating their slots do not share lines.
+ */
+template <class T>
+class shl_per_thread {
+
+private:
+    struct slot {
+        T value;
+    } __attribute__((aligned(CACHELINE)));
+
+    slot *slots;
+    int num;
+
+    shl_per_thread(const shl_per_thread&);
+    shl_per_thread& operator=(const shl_per_thread&);
+
+public:
+    shl_per_thread(void)
+        : num(shl__max_threads())
+    {
+        assert (num > 0);
+
+        void *mem = NULL;
+        int r = posix_memalign(&mem, CACHELINE, num * sizeof(slot));
+        assert (r == 0 && mem != NULL);
+
+        slots = (slot*) mem;
+        for (int i=0; i<num; i++) {
+            new (slots + i) slot();
+        }
+    }
+
+    ~shl_per_thread(void)
+    {
+        for (int i=0; i<num; i++) {
+            slots[i].~slot();
+        }
+        free(slots);
+    }
+
+    inline T& operator[](int tid)
+    {
+        assert (tid >= 0 && tid < num);
+        return slots[tid].value;
+    }
+
+    /**
+     * \brief Return the slot of the calling thread
+     */
+    inline T& local(void)
+    {
+        return (*this)[shl__get_tid()];
+    }
+
+    int size(void)
+    {
+        return num;
+    }
+};
+
+#endif /* __SHL_PER_THREAD */
@@ -27,6 +27,19 @@ int shl__node_from_cpu(int core_id)
     return numa_node_of_cpu((coreid_t)core_id);
 }
 
+/**
+ * \brief obtains the NUMA distance between two nodes
+ *
+ * \param node_a first node
+ * \param node_b second node
+ *
+ * \return 10 for the same node, 20 otherwise
+ */
+int shl__node_distance(int node_a, int node_b)
+{
+    return node_a == node_b ? 10 : 20;
+}
+
 /**
  * \brief checks availability of the NUMA
  *
@@ -122,6 +135,34 @@ bool shl__check_hugepage_support(void)
     return 0; // Barrelfish does not support huge pages
 }
 
+/**
+ * \brief Find sensible thread placement.
+ *
+ * There is no topology information, threads are bound to cores
+ * 0..num_cores-1 as in shl__barrelfish_init.
+ */
+void shl__auto_tune_bind(int *num_cores, coreid_t *bind, bool uses_barriers)
+{
+    int num = numa_num_configured_cpus();
+    if (*num_cores > 0 && *num_cores < num) {
+        num = *num_cores;
+    }
+
+    for (int i=0; bind && i<num; i++) {
+        bind[i] = i;
+    }
+
+    *num_cores = num;
+}
+
+/**
+ * \brief returns the size of a cacheline in bytes
+ */
+int shl__cacheline_size(void)
+{
+    return CACHELINE;
+}
+
 /**
  * \brief checks if the OS supports large pages
  *
@@ -422,3 +422,88 @@ void** shl__malloc_replicated(size_t size,
 
     return arrays;
 }
+
+/**
+ * \brief Allocate the replicas of a replication domain
+ *
+ * Domains other than the nodes are not supported, see
+ * shl__rep_domain_llc.
+ */
+void** shl__malloc_replicated_domain(size_t size,
+                                     const struct shl_rep_domain *domain,
+                                     int* num_replicas,
+                                     int* pagesize,
+                                     int options,
+                                     void ** ret_mi)
+{
+    assert(domain == NULL);
+
+    return shl__malloc_replicated(size, num_replicas, pagesize, options, ret_mi);
+}
+
+/**
+ * \brief Free memory allocated with shl__malloc, shl__malloc_distributed
+ * or shl__malloc_partitioned
+ *
+ * \param mi the memory information returned on allocation, freed as well
+ */
+void shl__free(void *addr, void *mi)
+{
+    errval_t err;
+
+    struct shl_mi_header *m = (struct shl_mi_header *) mi;
+    if (addr == NULL || m == NULL) {
+        return;
+    }
+
+    if (m->stride) {
+        /* memory of shl__malloc_numa is mapped through a NUMA memobj */
+        err = vregion_destroy(&m->vregion);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "vregion_destroy");
+        }
+
+        err = memobj_destroy_numa(&m->memobj.m);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "memobj_destroy_numa");
+        }
+    } else {
+        err = vspace_unmap(addr);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "vspace_unmap");
+        }
+    }
+
+    for (size_t i = 0; i < m->num; ++i) {
+        cap_destroy(m->data[i].frame);
+    }
+
+    free(m);
+}
+
+/**
+ * \brief Free memory allocated with shl__malloc_replicated
+ *
+ * Releases all replicas, the memory information and the table of
+ * replicas.
+ */
+void shl__free_replicated(void **replicas, void *mi)
+{
+    errval_t err;
+
+    struct shl_mi_header *m = (struct shl_mi_header *) mi;
+    if (replicas == NULL || m == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < m->num; ++i) {
+        err = vspace_unmap((void *) m->data[i].vaddr);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "vspace_unmap");
+        }
+        cap_destroy(m->data[i].frame);
+    }
+
+    free(m);
+    free(replicas);
+}
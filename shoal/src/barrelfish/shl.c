@@ -109,3 +109,30 @@ unsigned long shl__timer_get_timestamp(void)
     cycles_t cycles = bench_tsc();
     return bench_tsc_to_ms(cycles);
 }
+
+/**
+ * \brief dirty page tracking is not supported on Barrelfish
+ */
+struct shl__dirty_region* shl__dirty_track(void *addr, size_t size)
+{
+    return NULL;
+}
+
+void shl__dirty_untrack(struct shl__dirty_region *r)
+{
+}
+
+long shl__dirty_collect(struct shl__dirty_region *r, struct shl__range **runs)
+{
+    return -1;
+}
+
+/**
+ * \brief page migration is not supported on Barrelfish
+ */
+int shl__migrate(void *addr, size_t size, size_t element_size, int opts,
+                 int node, size_t stride, size_t chunk, void **mi,
+                 struct shl__migrate_stats *stats)
+{
+    return -1;
+}
@@ -2,11 +2,22 @@
 #include <cstdlib>
 
 #include <sched.h>
+#include <unistd.h>
+#include <time.h>
 #include <numa.h>
+#include <numaif.h>
+#include <pthread.h>
 
 #include "shl_internal.h"
 #include "shl_configuration.hpp"
 #include "shl.h"
+#include "backend/linux/meminfo.h"
+
+///< number of pages queried when verifying the placement of a region
+#define SHL_PLACEMENT_SAMPLES 64
+
+///< number of pages moved per call to move_pages when migrating
+#define SHL_MIGRATE_BATCH 1024
 
 void *shl__alloc_struct_shared(size_t size)
 {
@@ -31,7 +42,12 @@ aff_set_oncpu(unsigned int cpu)
 
 int shl__get_proc_for_node(int node)
 {
-    for (int i=0; i<MAXCORES; i++)
+    const int *cpus;
+    if (shl__topo_ready() && shl__topo_node_cpus(node, &cpus) > 0) {
+        return cpus[0];
+    }
+
+    for (int i=0; i<numa_num_configured_cpus(); i++)
         if (shl__node_from_cpu(i)==node)
             return i;
 
@@ -42,8 +58,8 @@ int shl__get_proc_for_node(int node)
 extern coreid_t *affinity_conf;
 void shl__bind_processor_aff(int id)
 {
-    printf("Binding [%d] to [%d]\n", id, affinity_conf[id]);
     if (affinity_conf!=NULL) {
+        printf("Binding [%d] to [%d]\n", id, affinity_conf[id]);
         aff_set_oncpu(affinity_conf[id]);
     }
 }
@@ -76,6 +92,10 @@ void shl__set_strict_mode(int id)
 int
 shl__node_from_cpu(int cpu)
 {
+    if (shl__topo_ready() && cpu >= 0 && cpu < shl__topo_num_cpus()) {
+        return shl__topo_cpu_node(cpu);
+    }
+
     int ret    = -1;
     int ncpus  = numa_num_possible_cpus();
     int node_max = numa_max_node();
@@ -104,6 +124,25 @@ shl__node_from_cpu(int cpu)
     return ret;
 }
 
+/**
+ * \brief obtains the NUMA distance between two nodes
+ *
+ * \returns the distance as reported by the SLIT, 10 for the same node
+ */
+int shl__node_distance(int node_a, int node_b)
+{
+    if (shl__topo_ready()) {
+        return shl__topo_node_distance(node_a, node_b);
+    }
+
+    int d = numa_distance(node_a, node_b);
+    if (d <= 0) {
+        // No distance information available
+        return node_a == node_b ? 10 : 20;
+    }
+    return d;
+}
+
 void** shl__copy_array(void *src, size_t size, bool is_used,
                        bool is_ro, const char* array_name)
 {
@@ -284,6 +323,251 @@ void shl__copy_back_array_single(void *src, void *dest, size_t size, bool is_cop
     }
 }
 
+static void* shl__distribute(void *addr, size_t size, size_t pagesize,
+                             size_t stride, size_t map_size);
+
+/**
+ * \brief Allocate a struct shl_mi_header with num entries
+ */
+static struct shl_mi_header* shl__meminfo_alloc(size_t num, void *vaddr)
+{
+    struct shl_mi_header *mi = (struct shl_mi_header*)
+        calloc(1, sizeof(*mi) + num * sizeof(struct shl_mi_data));
+    assert (mi);
+
+    mi->num = num;
+    mi->vaddr = vaddr;
+    mi->data = (struct shl_mi_data *)(mi+1);
+
+    return mi;
+}
+
+/**
+ * \brief Commit the memory described by mi to its nodes, or release it
+ */
+static void shl__meminfo_commit(struct shl_mi_header *mi, bool commit)
+{
+    for (size_t i=0; i<mi->num; i++) {
+        if (commit) {
+            shl__mem_reserve(mi->data[i].node, mi->data[i].size, true);
+        } else {
+            shl__mem_release(mi->data[i].node, mi->data[i].size);
+        }
+    }
+}
+
+/**
+ * \brief Iterate over the first size bytes of an array
+ *
+ * Replicated arrays are visited once per replica.
+ *
+ * \returns the sum of the return values of fn
+ */
+size_t shl__mi_foreach(struct shl_mi_header *mi, size_t size,
+                       shl__mi_fn_t fn, void *arg)
+{
+    size_t count = 0;
+
+    if (mi->vaddr == NULL) {
+        for (size_t i=0; i<mi->num; i++) {
+            count += fn((char*) mi->data[i].vaddr, 0, size,
+                        mi->data[i].node, arg);
+        }
+    } else if (mi->stride) {
+        for (size_t b=0; b*mi->stride<size; b++) {
+            size_t offset = b*mi->stride;
+            size_t bytes = size - offset < mi->stride ? size - offset : mi->stride;
+            count += fn((char*) mi->vaddr + offset, offset, bytes,
+                        mi->data[b % mi->num].node, arg);
+        }
+    } else {
+        size_t offset = 0;
+        for (size_t i=0; i<mi->num && offset<size; i++) {
+            size_t bytes = size - offset < mi->data[i].size ?
+                size - offset : mi->data[i].size;
+            count += fn((char*) mi->vaddr + offset, offset, bytes,
+                        mi->data[i].node, arg);
+            offset += bytes;
+        }
+    }
+
+    return count;
+}
+
+static int shl__mbind_node(void *addr, size_t size, int node);
+
+/*
+ * -------------------------------------------------------------------------------
+ * Pool of released mappings
+ *
+ * Arrays allocated with SHL_MALLOC_POOLED hand their mappings back
+ * to the pool of the node they are on when freed, up to a total of
+ * pool_size bytes from the configuration. Allocations of the same
+ * size class on the same node take them from there, so they start
+ * out with pages that are already placed and faulted in.
+ * -------------------------------------------------------------------------------
+ */
+
+struct shl__pool_entry {
+    void *addr;                     ///< start of the mapping
+    size_t size;                    ///< length of the mapping
+    int pagesize;                   ///< page size of the mapping
+    struct shl__pool_entry *next;
+};
+
+///< free lists, indexed by node+1 (0 for mappings of unknown placement)
+static struct shl__pool_entry **pool_lists = NULL;
+static size_t pool_bytes = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * \brief Return the length of the mapping backing size bytes
+ *
+ * Pooled mappings are rounded up to a size class, so that they can
+ * be reused for arrays of slightly different sizes. Size classes are
+ * a quarter of a power of two apart, bounding the waste to 25%.
+ */
+static size_t shl__map_size(size_t size, int opts, size_t pagesize)
+{
+    size_t map_size = ((size + pagesize - 1) / pagesize) * pagesize;
+    if (map_size == 0) {
+        map_size = pagesize;
+    }
+
+    if (opts & SHL_MALLOC_POOLED) {
+        size_t step = pagesize;
+        while (step * 8 <= map_size) {
+            step *= 2;
+        }
+        map_size = ((map_size + step - 1) / step) * step;
+    }
+
+    return map_size;
+}
+
+/**
+ * \brief Take a mapping of the given size class from the pool
+ *
+ * \returns the mapping, or NULL if there is none
+ */
+static void* shl__pool_get(size_t map_size, int pagesize, int node)
+{
+    void *res = NULL;
+
+    pthread_mutex_lock(&pool_lock);
+
+    struct shl__pool_entry **e = pool_lists ? pool_lists + (node + 1) : NULL;
+    while (e && *e) {
+        if ((*e)->size == map_size && (*e)->pagesize == pagesize) {
+            struct shl__pool_entry *found = *e;
+            *e = found->next;
+            pool_bytes -= found->size;
+            res = found->addr;
+            free(found);
+            break;
+        }
+        e = &(*e)->next;
+    }
+
+    pthread_mutex_unlock(&pool_lock);
+
+    return res;
+}
+
+/**
+ * \brief Hand a mapping to the pool
+ *
+ * \returns true if the pool took the mapping, false if it is full
+ */
+static bool shl__pool_put(void *addr, size_t map_size, int pagesize, int node)
+{
+    bool res = false;
+
+    pthread_mutex_lock(&pool_lock);
+
+    if (pool_lists == NULL) {
+        pool_lists = (struct shl__pool_entry**)
+            calloc(numa_max_node() + 2, sizeof(struct shl__pool_entry*));
+        assert (pool_lists);
+    }
+
+    if (pool_bytes + map_size <= get_conf()->pool_size) {
+
+        struct shl__pool_entry *e = (struct shl__pool_entry*)
+            malloc(sizeof(struct shl__pool_entry));
+        assert (e);
+
+        e->addr = addr;
+        e->size = map_size;
+        e->pagesize = pagesize;
+        e->next = pool_lists[node + 1];
+        pool_lists[node + 1] = e;
+        pool_bytes += map_size;
+        res = true;
+    }
+
+    pthread_mutex_unlock(&pool_lock);
+
+    return res;
+}
+
+/**
+ * \brief Map memory, bound to node unless it is SHL_NUMA_IGNORE
+ *
+ * \param reused returns whether the mapping was taken from the pool
+ *
+ * \returns the mapping, or NULL if the kernel refused to map it
+ */
+static void* shl__map(size_t map_size, int opts, int pagesize, int node,
+                      bool *reused)
+{
+    void *res = NULL;
+
+    if (opts & SHL_MALLOC_POOLED) {
+        res = shl__pool_get(map_size, pagesize, node);
+    }
+
+    *reused = res != NULL;
+    if (res) {
+        return res;
+    }
+
+    // Set options for mmap
+    int options = MAP_ANONYMOUS | MAP_PRIVATE;
+    if (opts & SHL_MALLOC_HUGEPAGE)
+        options |= MAP_HUGETLB;
+
+    // mmap returns memory aligned to the page size in use
+    res = mmap(NULL, map_size, PROT_READ | PROT_WRITE, options, -1, 0);
+    if (res==MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    if (node != SHL_NUMA_IGNORE && shl__mbind_node(res, map_size, node)) {
+        printf(ANSI_COLOR_RED "WARNING:" ANSI_COLOR_RESET
+               " cannot bind mapping to node %d\n", node);
+    }
+
+    return res;
+}
+
+/**
+ * \brief Release a mapping, to the pool if it was allocated pooled
+ */
+static void shl__unmap(void *addr, size_t map_size, int opts, int pagesize,
+                       int node)
+{
+    if ((opts & SHL_MALLOC_POOLED) &&
+        shl__pool_put(addr, map_size, pagesize, node)) {
+        return;
+    }
+
+    if (munmap(addr, map_size)) {
+        perror("munmap");
+    }
+}
+
 /**
  * \brief ALlocate memory with the given flags.
  *
@@ -296,9 +580,20 @@ void shl__copy_back_array_single(void *src, void *dest, size_t size, bool is_cop
  *   enable hugepage support
  *
  * - SHL_MALLOC_DISTRIBUTED:
- *    distribute memory approximately equally on nodes that have threads
+ *    distribute memory block-cyclic on nodes that have threads, using
+ *    the stride from the configuration (see shl__malloc_distributed)
+ *
+ * - SHL_MALLOC_POOLED:
+ *    reuse a mapping released by shl__free if possible, and hand the
+ *    mapping back to the pool when freed. Contents of reused
+ *    mappings are undefined.
+ *
+ * \param node   bind the memory to this node, unless SHL_NUMA_IGNORE
+ * \param ret_mi Returns a struct shl_mi_header describing the memory,
+ *     needed to free it with shl__free. The memory is committed to its
+ *     nodes (see shl__mem_reserve) only if ret_mi is given.
  *
- * \param ret_mi Is unused on Linux
+ * \returns the memory, or NULL if it cannot be mapped
  */
 void* shl__malloc(size_t size, int opts, int *pagesize, int node, void **ret_mi)
 {
@@ -309,45 +604,41 @@ void* shl__malloc(size_t size, int opts, int *pagesize, int node, void **ret_mi)
     bool partition = opts & SHL_MALLOC_PARTITION;
     bool single_node = opts & SHL_MALLOC_SINGLE_NODE;
 
+    // Pages of distributed memory are on different nodes, so it
+    // cannot be reused for anything else
+    if (distribute) {
+        opts &= ~SHL_MALLOC_POOLED;
+    }
+
     // Round up to next multiple of page size (in case of hugepage)
     *pagesize = use_hugepage ? PAGESIZE_HUGE : PAGESIZE;
-    size_t alloc_size = size;
-    while (use_hugepage && (alloc_size % *pagesize != 0))
-        alloc_size++;
-
-    // Set options for mmap
-    int options = MAP_ANONYMOUS | MAP_PRIVATE;
-    if (use_hugepage)
-        options |= MAP_HUGETLB;
-
-    printf("shl__alloc: %zu, huge=%d, distribute=%d",
-           alloc_size, use_hugepage, distribute);
-
-    // Allocate (alloc_size + 1 page)
-    // might have to shift if memory returned is not starting on page boundary
-    res = mmap(NULL, alloc_size + *pagesize, PROT_READ | PROT_WRITE, options, -1, 0);
-    if (res==MAP_FAILED) {
-        perror("mmap");
-        exit(1);
+    size_t alloc_size = shl__map_size(size, opts, *pagesize);
+
+    bool reused;
+    res = shl__map(alloc_size, opts, *pagesize, node, &reused);
+    if (res == NULL) {
+        printf(ANSI_COLOR_RED "WARNING:" ANSI_COLOR_RESET
+               " shl__alloc: cannot map %zu bytes\n", alloc_size);
+        return NULL;
     }
 
-    // Want the first element of the array starting at pageboundary
-    size_t rres = (size_t) res;
-    while (rres % (*pagesize) != 0) rres++;
-    res = (void*) rres;
+    printf("shl__alloc: %zu, huge=%d, distribute=%d, reused=%d",
+           alloc_size, use_hugepage, distribute, reused);
 
     // Distribute memory
     // --------------------------------------------------
     if (distribute) {
 
-        // XXX we need to make sure that this loop actually
-        // distributes memory. If we use hugepages, it might be that
-        // all threads work on the SAME page, which leads to
-        // imbalance. See gaud2014large
-#pragma omp parallel for
-        for (uint64_t i=0; i<alloc_size;i ++) {
-
-            ((char *) res)[i] = 0;
+        // Block-cyclic distribution applied with memory policies,
+        // so that placement does not depend on which thread touches
+        // a page first (which leads to imbalance with hugepages,
+        // see gaud2014large)
+        void *mi = shl__distribute(res, alloc_size, *pagesize,
+                                   get_conf()->stride, alloc_size);
+        if (ret_mi) {
+            *ret_mi = mi;
+        } else {
+            free(mi);
         }
     }
 
@@ -356,82 +647,893 @@ void* shl__malloc(size_t size, int opts, int *pagesize, int node, void **ret_mi)
     // --------------------------------------------------
     if (partition) {
 
-        // SK: cannot establish mapping here, as size of array
-        // elements is not known
+        // Cannot establish mapping here, as size of array elements
+        // is not known. Use shl__malloc_partitioned instead.
     }
 
 
     // Single node
     // --------------------------------------------------
-    if (single_node) {
+    if (single_node && !reused) {
 
         // Write every page once to trigger mapping of pages.
         // Do this from a single thread.
-        for (uint64_t i=0; i<alloc_size;i ++) {
+        for (uint64_t i=0; i<size; i+=*pagesize) {
 
             ((char *) res)[i] = 0;
         }
     }
 
+    if (ret_mi && !distribute) {
+        *ret_mi = shl__meminfo_alloc(1, res);
+        struct shl_mi_data *d = ((struct shl_mi_header*) *ret_mi)->data;
+        d->vaddr = res;
+        d->size = alloc_size;
+        d->node = node;
+    }
+
+    if (ret_mi) {
+        struct shl_mi_header *mi = (struct shl_mi_header*) *ret_mi;
+        mi->map_size = alloc_size;
+        mi->pagesize = *pagesize;
+        mi->opts = opts;
+        shl__meminfo_commit(mi, true);
+    }
+
     printf("\n");
 
     return res;
 }
 
+/**
+ * \brief Free memory allocated with shl__malloc, shl__malloc_distributed
+ * or shl__malloc_partitioned
+ *
+ * \param mi the memory information returned on allocation, freed as well
+ */
+void shl__free(void *addr, void *mi)
+{
+    struct shl_mi_header *m = (struct shl_mi_header*) mi;
+
+    // Without memory information, the size of the mapping is not known
+    if (addr == NULL || m == NULL) {
+        return;
+    }
+
+    assert (m->vaddr == addr);
+
+    int node = (m->num == 1) ? m->data[0].node : SHL_NUMA_IGNORE;
+    shl__unmap(addr, m->map_size, m->opts, m->pagesize, node);
+    shl__meminfo_commit(m, false);
+
+    free(m);
+}
+
+/**
+ * \brief Free memory allocated with shl__malloc_replicated
+ *
+ * Releases all replicas, the memory information and the table of
+ * replicas.
+ */
+void shl__free_replicated(void **replicas, void *mi)
+{
+    struct shl_mi_header *m = (struct shl_mi_header*) mi;
+
+    if (replicas == NULL || m == NULL) {
+        return;
+    }
+
+    for (size_t i=0; i<m->num; i++) {
+        shl__unmap(m->data[i].vaddr, m->map_size, m->opts, m->pagesize,
+                   m->data[i].node);
+    }
+    shl__meminfo_commit(m, false);
+
+    free(m);
+    free(replicas);
+}
+
+/**
+ * \brief Bind a memory range to a single node
+ *
+ * Applies an explicit MPOL_BIND memory policy, so that pages are
+ * allocated on the given node no matter which thread touches them
+ * first.
+ *
+ * \returns 0 on success, -1 if the node cannot hold memory
+ */
+static int shl__mbind_node(void *addr, size_t size, int node)
+{
+    if (node<0 || node>numa_max_node()) {
+        return -1;
+    }
+
+    struct bitmask *nodes = numa_allocate_nodemask();
+    numa_bitmask_setbit(nodes, node);
+
+    long err = mbind(addr, size, MPOL_BIND, nodes->maskp, nodes->size + 1, 0);
+    if (err) {
+        perror("mbind");
+    }
+
+    numa_bitmask_free(nodes);
+
+    return err ? -1 : 0;
+}
+
+/**
+ * \brief Return the node page p of a partitioned array is bound to
+ */
+static int shl__partition_node(size_t p, size_t pagesize, size_t element_size,
+                               size_t elements, size_t chunk,
+                               size_t num_threads)
+{
+    size_t i = (p * pagesize) / element_size;
+    size_t tid = shl__static_schedule_owner(i, elements, chunk, num_threads);
+
+    return replica_lookup[tid];
+}
+
+static size_t shl__bind_part(char *addr, size_t offset, size_t bytes,
+                             int node, void *arg)
+{
+    if (node >= 0 && shl__mbind_node(addr, bytes, node)) {
+        printf(ANSI_COLOR_RED "WARNING:" ANSI_COLOR_RESET
+               " cannot bind %zu bytes at offset %zu to node %d\n",
+               bytes, offset, node);
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Bind the mapping of an array to the nodes given by mi
+ *
+ * All mi->map_size bytes are bound, as mbind fails for ranges not
+ * ending on a page boundary (e.g. of huge pages). Memory behind the
+ * last extent of a contiguous array goes to the node of that extent.
+ *
+ * \returns the number of parts that could not be bound
+ */
+static size_t shl__meminfo_bind(struct shl_mi_header *mi)
+{
+    size_t size = mi->map_size;
+
+    if (mi->stride || mi->vaddr == NULL) {
+        return shl__mi_foreach(mi, size, shl__bind_part, NULL);
+    }
+
+    size_t failed = 0;
+    size_t offset = 0;
+    for (size_t i=0; i<mi->num && offset<size; i++) {
+        size_t bytes = i == mi->num-1 || size - offset < mi->data[i].size ?
+            size - offset : mi->data[i].size;
+        failed += shl__bind_part((char*) mi->vaddr + offset, offset, bytes,
+                                 mi->data[i].node, NULL);
+        offset += bytes;
+    }
+
+    return failed;
+}
+
+/**
+ * \brief Determine the placement of a partitioned array
+ *
+ * Every page goes to the node of the thread that, under
+ * "schedule(static, chunk)", executes the iteration of the element
+ * holding the page's first byte. Pages straddling chunk boundaries
+ * hence always go to the owner of the lower chunk. A chunk of 0
+ * stands for "schedule(static)".
+ *
+ * \returns memory information with one entry per run of pages on the
+ *     same node
+ */
+static struct shl_mi_header* shl__partition_plan(char *addr, size_t size,
+                                                 size_t pagesize,
+                                                 size_t element_size,
+                                                 size_t chunk)
+{
+    size_t num_threads = get_conf()->num_threads;
+    size_t elements = size / element_size;
+    size_t num_pages = (size + pagesize - 1) / pagesize;
+
+    if (num_threads == 0 || elements == 0) {
+        num_pages = 0;
+    }
+
+    // Count runs of pages that end up on the same node
+    size_t num_runs = 0;
+    int run_node = -1;
+    for (size_t p=0; p<num_pages; p++) {
+        int node = shl__partition_node(p, pagesize, element_size, elements,
+                                       chunk, num_threads);
+        if (node != run_node) {
+            num_runs++;
+            run_node = node;
+        }
+    }
+
+    struct shl_mi_header *mi = shl__meminfo_alloc(num_runs ? num_runs : 1, addr);
+    if (num_runs == 0) {
+        mi->data[0].vaddr = addr;
+        mi->data[0].size = size;
+        mi->data[0].node = SHL_NUMA_IGNORE;
+    }
+
+    // Record the runs
+    size_t run_start = 0;
+    size_t run = 0;
+    run_node = -1;
+
+    for (size_t p=0; p<=num_pages; p++) {
+
+        int node = -1;
+        if (p<num_pages) {
+            node = shl__partition_node(p, pagesize, element_size, elements,
+                                       chunk, num_threads);
+        }
+
+        if (node == run_node)
+            continue;
+
+        if (run_node >= 0) {
+            mi->data[run].vaddr = addr + run_start*pagesize;
+            mi->data[run].size = (p-run_start)*pagesize;
+            mi->data[run].node = run_node;
+            run++;
+        }
+
+        run_start = p;
+        run_node = node;
+    }
+
+    SHL_DEBUG_ALLOC("partitioned %zu pages in %zu runs (chunk %zu)\n",
+                    num_pages, num_runs, chunk);
+
+    return mi;
+}
+
+/**
+ * \brief Allocate memory partitioned according to an OpenMP static schedule
+ *
+ * See shl__partition_plan for the placement.
+ *
+ * Placement is applied with memory policies only, so the memory is
+ * not touched here and pages materialize on their node whenever they
+ * are first written.
+ *
+ * \param size         size of the array in bytes
+ * \param element_size size of one array element in bytes
+ * \param chunk        chunk size of the static schedule
+ */
+void *shl__malloc_partitioned(size_t size,
+                              size_t element_size,
+                              size_t chunk,
+                              int opts,
+                              int *pagesize,
+                              void **ret_mi)
+{
+    assert (element_size>0);
+
+    // Pages are on different nodes, which rules out reuse
+    opts &= ~SHL_MALLOC_POOLED;
+
+    char *res = (char*) shl__malloc(size, opts, pagesize, SHL_NUMA_IGNORE, NULL);
+    if (res == NULL) {
+        return NULL;
+    }
+
+    struct shl_mi_header *mi = shl__partition_plan(res, size, *pagesize,
+                                                   element_size, chunk);
+    mi->map_size = shl__map_size(size, opts, *pagesize);
+    mi->pagesize = *pagesize;
+    mi->opts = opts;
+
+    shl__meminfo_bind(mi);
+
+    if (ret_mi) {
+        shl__meminfo_commit(mi, true);
+        *ret_mi = mi;
+    } else {
+        free(mi);
+    }
+
+    return res;
+}
+
+/**
+ * \brief Determine the nodes that have threads running on them
+ *
+ * Falls back to all nodes if Shoal's threads are not known yet.
+ *
+ * \param nodes array of at least numa_max_node()+1 entries
+ *
+ * \returns number of nodes written to nodes (in ascending order)
+ */
+static int shl__active_nodes(int *nodes)
+{
+    int max_node = numa_max_node();
+    int num = 0;
+
+    for (int node=0; node<=max_node; node++) {
+
+        bool active = get_conf()->num_threads == 0;
+        for (size_t t=0; t<get_conf()->num_threads && !active; t++) {
+            active = replica_lookup[t] == node;
+        }
+
+        if (active && numa_bitmask_isbitset(numa_all_nodes_ptr, node)) {
+            nodes[num++] = node;
+        }
+    }
+
+    return num;
+}
+
+/**
+ * \brief Determine the placement of a block-cyclic distributed array
+ *
+ * Block b (of stride bytes) goes to the (b % n)-th of the n nodes
+ * that have threads. The stride is rounded up to a multiple of the
+ * page size, as pages cannot be split between nodes.
+ *
+ * \returns struct shl_mi_header describing the distribution
+ */
+static struct shl_mi_header* shl__distribute_plan(void *addr, size_t size,
+                                                  size_t pagesize,
+                                                  size_t stride)
+{
+    int *nodes = (int*) malloc((numa_max_node()+1)*sizeof(int));
+    assert (nodes);
+    int num_nodes = shl__active_nodes(nodes);
+    assert (num_nodes>0);
+
+    if (stride == 0 || stride % pagesize) {
+        size_t aligned = ((stride + pagesize - 1) / pagesize) * pagesize;
+        if (aligned == 0)
+            aligned = pagesize;
+        printf(ANSI_COLOR_YELLOW "WARNING:" ANSI_COLOR_RESET
+               " stride %zu is not a multiple of the page size, using %zu\n",
+               stride, aligned);
+        stride = aligned;
+    }
+
+    struct shl_mi_header *mi = shl__meminfo_alloc(num_nodes, addr);
+    mi->stride = stride;
+
+    for (int i=0; i<num_nodes; i++) {
+        mi->data[i].vaddr = (char*) addr + i*stride;
+        mi->data[i].node = nodes[i];
+    }
+
+    size_t num_blocks = (size + stride - 1) / stride;
+    for (size_t b=0; b<num_blocks; b++) {
+        size_t offset = b*stride;
+        size_t len = (offset + stride > size) ? size - offset : stride;
+        mi->data[b % num_nodes].size += len;
+    }
+
+    SHL_DEBUG_ALLOC("distributed %zu blocks of %zu bytes on %d nodes\n",
+                    num_blocks, stride, num_nodes);
+
+    free(nodes);
+
+    return mi;
+}
+
+/**
+ * \brief Distribute a memory region block-cyclic over the active nodes
+ *
+ * See shl__distribute_plan for the placement.
+ *
+ * \returns struct shl_mi_header describing the distribution
+ */
+static void* shl__distribute(void *addr, size_t size, size_t pagesize,
+                             size_t stride, size_t map_size)
+{
+    struct shl_mi_header *mi = shl__distribute_plan(addr, size, pagesize,
+                                                    stride);
+    mi->map_size = map_size;
+    mi->pagesize = pagesize;
+
+    shl__meminfo_bind(mi);
+
+    return mi;
+}
+
+/**
+ * \brief Allocate memory distributed block-cyclic on the active nodes
+ *
+ * \param stride size of the blocks in bytes; rounded up to the page
+ *     size, so huge pages get distributed at huge page granularity.
+ */
+void* shl__malloc_distributed(size_t size,
+                              int opts,
+                              int *pagesize,
+                              size_t stride,
+                              void **ret_mi)
+{
+    opts &= ~(SHL_MALLOC_DISTRIBUTED | SHL_MALLOC_POOLED);
+
+    void *res = shl__malloc(size, opts, pagesize, SHL_NUMA_IGNORE, NULL);
+    if (res == NULL) {
+        return NULL;
+    }
+
+    struct shl_mi_header *mi = (struct shl_mi_header*)
+        shl__distribute(res, size, *pagesize, stride,
+                        shl__map_size(size, opts, *pagesize));
+    mi->opts = opts;
+
+    if (ret_mi) {
+        shl__meminfo_commit(mi, true);
+        *ret_mi = mi;
+    } else {
+        free(mi);
+    }
+
+    return res;
+}
+
+/**
+ * \brief Count pages of a memory region that are not on the given node
+ *
+ * Only a sample of SHL_PLACEMENT_SAMPLES pages is queried.
+ */
+static int shl__check_placement(void *addr, size_t size, size_t pagesize,
+                                int node, int *sampled)
+{
+    void *pages[SHL_PLACEMENT_SAMPLES];
+    int status[SHL_PLACEMENT_SAMPLES];
+
+    size_t num_pages = (size + pagesize - 1) / pagesize;
+    size_t step = (num_pages + SHL_PLACEMENT_SAMPLES - 1) / SHL_PLACEMENT_SAMPLES;
+    if (step == 0)
+        step = 1;
+
+    int count = 0;
+    for (size_t p=0; p<num_pages && count<SHL_PLACEMENT_SAMPLES; p+=step) {
+        pages[count++] = (char*) addr + p*pagesize;
+    }
+
+    if (move_pages(0, count, pages, NULL, status, 0)) {
+        perror("move_pages");
+        return count;
+    }
+
+    *sampled = count;
+
+    int misplaced = 0;
+    for (int i=0; i<count; i++) {
+        if (status[i] != node)
+            misplaced++;
+    }
+
+    return misplaced;
+}
+
+/*
+ * -------------------------------------------------------------------------------
+ * Migration
+ * -------------------------------------------------------------------------------
+ */
+
+struct shl__migrate_list {
+    void **pages;           ///< first byte of every page
+    int *nodes;             ///< target node of every page
+    size_t num;             ///< number of pages listed
+    size_t pagesize;
+};
+
+static size_t shl__migrate_list_part(char *addr, size_t offset, size_t bytes,
+                                     int node, void *arg)
+{
+    struct shl__migrate_list *l = (struct shl__migrate_list*) arg;
+
+    for (size_t p=0; p<bytes; p+=l->pagesize) {
+        l->pages[l->num] = addr + p;
+        l->nodes[l->num] = node;
+        l->num++;
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Re-place the memory of an array under a new policy
+ *
+ * The new placement is selected by opts:
+ *
+ * - SHL_MALLOC_DISTRIBUTED: block-cyclic with the given stride
+ *   (see shl__distribute_plan)
+ *
+ * - SHL_MALLOC_PARTITION: following "schedule(static, chunk)"
+ *   (see shl__partition_plan)
+ *
+ * - otherwise: everything on the given node
+ *
+ * The memory policies are replaced, so pages that are not present yet
+ * end up on their new node when first touched. Present pages are moved
+ * with move_pages, in batches of SHL_MIGRATE_BATCH pages that all
+ * threads process in parallel. Contents are preserved.
+ *
+ * \param addr  start of the array, as returned on allocation
+ * \param mi    memory information of the array, replaced with one
+ *     describing the new placement
+ * \param stats returns the number of bytes moved and the time it took
+ *
+ * \returns 0 on success, -1 if the memory cannot be migrated
+ */
+int shl__migrate(void *addr, size_t size, size_t element_size, int opts,
+                 int node, size_t stride, size_t chunk, void **mi,
+                 struct shl__migrate_stats *stats)
+{
+    struct shl_mi_header *old = (struct shl_mi_header*) *mi;
+
+    // Replicas cannot be re-placed, there is one per node already
+    if (addr == NULL || old == NULL || old->vaddr != addr) {
+        return -1;
+    }
+
+    bool distribute = opts & SHL_MALLOC_DISTRIBUTED;
+    bool partition = opts & SHL_MALLOC_PARTITION;
+
+    if (!distribute && !partition && (node < 0 || node > numa_max_node())) {
+        return -1;
+    }
+
+    struct timespec t_start, t_end;
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+
+    // New placement
+    // --------------------------------------------------
+    size_t pagesize = old->pagesize;
+    struct shl_mi_header *m;
+
+    if (distribute) {
+        m = shl__distribute_plan(addr, size, pagesize, stride);
+    } else if (partition) {
+        assert (element_size>0);
+        m = shl__partition_plan((char*) addr, size, pagesize, element_size,
+                                chunk);
+    } else {
+        m = shl__meminfo_alloc(1, addr);
+        m->data[0].vaddr = addr;
+        m->data[0].size = size;
+        m->data[0].node = node;
+    }
+
+    m->map_size = old->map_size;
+    m->pagesize = pagesize;
+    m->opts = old->opts & ~(SHL_MALLOC_DISTRIBUTED | SHL_MALLOC_PARTITION |
+                            SHL_MALLOC_SINGLE_NODE);
+    m->opts |= opts & (SHL_MALLOC_DISTRIBUTED | SHL_MALLOC_PARTITION);
+    if (distribute || partition) {
+        m->opts &= ~SHL_MALLOC_POOLED;
+    }
+
+    shl__meminfo_bind(m);
+
+    // Move present pages
+    // --------------------------------------------------
+    size_t num_pages = (size + pagesize - 1) / pagesize;
+
+    struct shl__migrate_list l;
+    l.pages = (void**) malloc(num_pages * sizeof(void*));
+    l.nodes = (int*) malloc(num_pages * sizeof(int));
+    l.num = 0;
+    l.pagesize = pagesize;
+
+    int *before = (int*) malloc(num_pages * sizeof(int));
+    int *status = (int*) malloc(num_pages * sizeof(int));
+    assert (l.pages && l.nodes && before && status);
+
+    shl__mi_foreach(m, size, shl__migrate_list_part, &l);
+    assert (l.num == num_pages);
+
+    size_t num_batches = (num_pages + SHL_MIGRATE_BATCH - 1) / SHL_MIGRATE_BATCH;
+    size_t moved = 0;
+    size_t failed = 0;
+
+#pragma omp parallel for schedule(dynamic) reduction(+:moved,failed)
+    for (size_t b=0; b<num_batches; b++) {
+
+        size_t first = b * SHL_MIGRATE_BATCH;
+        size_t count = num_pages - first < SHL_MIGRATE_BATCH ?
+            num_pages - first : SHL_MIGRATE_BATCH;
+
+        // Where the pages are now; -ENOENT if not present
+        if (move_pages(0, count, l.pages + first, NULL, before + first, 0)) {
+            perror("move_pages");
+        }
+
+        if (move_pages(0, count, l.pages + first, l.nodes + first,
+                       status + first, MPOL_MF_MOVE) < 0) {
+            perror("move_pages");
+        }
+
+        for (size_t i=first; i<first+count; i++) {
+            if (before[i] < 0 || before[i] == l.nodes[i] || l.nodes[i] < 0)
+                continue;
+
+            if (status[i] == l.nodes[i]) {
+                moved++;
+            } else {
+                failed++;
+            }
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+
+    if (failed) {
+        printf(ANSI_COLOR_RED "WARNING:" ANSI_COLOR_RESET
+               " migration: %zu of %zu pages could not be moved\n",
+               failed, num_pages);
+    }
+
+    if (stats) {
+        stats->pages = num_pages;
+        stats->bytes_moved = moved * pagesize;
+        stats->pages_failed = failed;
+        stats->time = (t_end.tv_sec - t_start.tv_sec) +
+            (t_end.tv_nsec - t_start.tv_nsec) / 1e9;
+    }
+
+    // Account for the new placement
+    // --------------------------------------------------
+    shl__meminfo_commit(old, false);
+    shl__meminfo_commit(m, true);
+    free(old);
+    *mi = m;
+
+    free(l.pages);
+    free(l.nodes);
+    free(before);
+    free(status);
+
+    return 0;
+}
+
+struct shl__populate_arg {
+    char *addr;      ///< start of the region
+    size_t size;     ///< size of the region in bytes
+    size_t pagesize; ///< page size used for the region
+    int node;        ///< node the region is bound to
+};
+
+/**
+ * \brief Fault in every page of a region from a thread on its node
+ *
+ * The memory policy already determines placement, running on the
+ * node just keeps page zeroing local.
+ */
+static void* shl__populate_region(void *arg)
+{
+    struct shl__populate_arg *a = (struct shl__populate_arg*) arg;
+
+    numa_run_on_node(a->node);
+
+    for (size_t j=0; j<a->size; j+=a->pagesize)
+        a->addr[j] = 0;
+
+    return NULL;
+}
+
+/**
+ * \brief returns whether any node served by a replica has CPUs the
+ * process can run on
+ */
+static bool shl__rep_has_cpus(int rep)
+{
+    if (!shl__topo_ready()) {
+        return true;
+    }
+
+    for (int node=0; node<=shl__max_node(); node++) {
+        if (shl__rep_of_node(node) == rep && shl__topo_node_cpus(node, NULL) > 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
 
 /**
  *
  * \param num_replicas Specifies the number of replicas to be
  * generated. If value given is <0, shl_malloc_replicated will
  * determine the number of replicas to be used.
+ *
+ * Every replica is bound to its node with an explicit memory policy
+ * and then populated by one thread per replica, all running in
+ * parallel. Replicas that cannot be placed on their node are
+ * reported. Replicas taken from the pool (SHL_MALLOC_POOLED) are
+ * already in place and not populated again.
+ *
+ * Every replica is committed to its node (see shl__mem_reserve). A
+ * replica that does not fit is not allocated; its entry instead
+ * points to the nearest replica that does (partial replication), so
+ * *num_replicas does not change.
+ *
+ * \returns the replicas, or NULL if none of them fits or can be mapped
  */
 void** shl__malloc_replicated(size_t size,
-                              int* pagesize,
                               int* num_replicas,
+                              int* pagesize,
                               int options,
                               void **meminfo)
+{
+    return shl__malloc_replicated_domain(size, NULL, num_replicas, pagesize,
+                                         options, meminfo);
+}
+
+/**
+ * \brief Allocate the replicas of a replication domain
+ *
+ * Like shl__malloc_replicated, with replica i on the node given by
+ * shl__rep_domain_node. The NULL domain has a replica per node.
+ */
+void** shl__malloc_replicated_domain(size_t size,
+                                     const struct shl_rep_domain *domain,
+                                     int* num_replicas,
+                                     int* pagesize,
+                                     int options,
+                                     void **meminfo)
 {
     if (*num_replicas<=0) {
-        *num_replicas = shl__get_num_replicas();
+        *num_replicas = shl__rep_domain_num(domain);
     }
 
-    assert (*num_replicas>0 && *num_replicas<12); // Sanity check
+    assert (*num_replicas>0); // Sanity check
+
+    void **tmp = (void**) (calloc(*num_replicas, sizeof(void*)));
+    pthread_t *threads = (pthread_t*) malloc(*num_replicas*sizeof(pthread_t));
+    struct shl__populate_arg *args = (struct shl__populate_arg*)
+        malloc(*num_replicas*sizeof(struct shl__populate_arg));
+    assert (tmp && threads && args);
 
-    void **tmp = (void**) (malloc(*num_replicas*sizeof(void*)));
+    *pagesize = (options & SHL_MALLOC_HUGEPAGE) ? PAGESIZE_HUGE : PAGESIZE;
+    size_t map_size = shl__map_size(size, options, *pagesize);
+    bool *reused = (bool*) malloc(*num_replicas*sizeof(bool));
+    bool *own = (bool*) calloc(*num_replicas, sizeof(bool));
+    assert (reused && own);
 
+    int num_own = 0;
     for (int i=0; i<*num_replicas; i++) {
 
-        // Allocate memory
+        int node = shl__rep_domain_node(domain, i);
+
+        args[i].size = size;
+        args[i].pagesize = *pagesize;
+        args[i].node = node;
+
+        // Nodes the process cannot run on (e.g. outside the cpuset of
+        // its container) get no replica of their own
         // --------------------------------------------------
+        if (domain == NULL && !shl__rep_has_cpus(i)) {
+            printf("replication: replica %d has no CPUs in the affinity mask\n", i);
+            continue;
+        }
 
-        // Allocate
-        tmp[i] = shl__malloc(size, options, pagesize, SHL_NUMA_IGNORE, NULL);
-        assert(tmp[i]);
+        // Admission
+        // --------------------------------------------------
+        if (!shl__mem_reserve(node, size, !get_conf()->use_admission)) {
+            printf(ANSI_COLOR_YELLOW "WARNING:" ANSI_COLOR_RESET
+                   " replica %d does not fit on node %d (%zu of %zu bytes free)\n",
+                   i, node, shl__mem_free(node), size);
+            continue;
+        }
 
-        // Allocate on proper node; leverage Linux's first touch strategy
+        // Allocate memory, bound to the proper node; placement no
+        // longer depends on which thread touches the pages first
         // --------------------------------------------------
+        tmp[i] = shl__map(map_size, options, *pagesize, node, reused+i);
+        if (tmp[i] == NULL) {
+            shl__mem_release(node, size);
+            printf(ANSI_COLOR_YELLOW "WARNING:" ANSI_COLOR_RESET
+                   " cannot map replica %d on node %d\n", i, node);
+            continue;
+        }
+
+        args[i].addr = (char*) tmp[i];
+        own[i] = true;
+        num_own++;
+    }
+
+    if (num_own == 0) {
+        printf(ANSI_COLOR_RED "WARNING:" ANSI_COLOR_RESET
+               " no replica of %zu bytes fits on any node\n", size);
+        free(tmp);
+        free(threads);
+        free(args);
+        free(reused);
+        free(own);
+        return NULL;
+    }
 
-        cpu_set_t cpu_mask_org;
-        int err = sched_getaffinity(0, sizeof(cpu_set_t), &cpu_mask_org);
-        if (err) {
-            perror("sched_getaffinity");
+    // Replicas that do not fit use the nearest one that does
+    // --------------------------------------------------
+    for (int i=0; i<*num_replicas; i++) {
+
+        if (own[i])
+            continue;
+
+        int best = -1;
+        for (int j=0; j<*num_replicas; j++) {
+            if (own[j] && (best < 0 ||
+                           shl__node_distance(args[i].node, args[j].node) <
+                           shl__node_distance(args[i].node, args[best].node))) {
+                best = j;
+            }
+        }
+
+        printf("replication: replica %d on node %d shares replica %d on node %d\n",
+               i, args[i].node, best, args[best].node);
+        tmp[i] = tmp[best];
+    }
+
+    // Populate all new replicas in parallel
+    // --------------------------------------------------
+    for (int i=0; i<*num_replicas; i++) {
+        if (own[i] && !reused[i] &&
+            pthread_create(threads+i, NULL, shl__populate_region, args+i)) {
+            perror("pthread_create");
             exit(1);
         }
+    }
+
+    for (int i=0; i<*num_replicas; i++) {
+        if (own[i] && !reused[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
 
-        // bind processor
-        shl__bind_processor(shl__get_proc_for_node(i));
+    // Report nodes that could not be satisfied
+    // --------------------------------------------------
+    for (int i=0; i<*num_replicas; i++) {
 
-        // write once on every page
-        for (size_t j=0; j<size; j+=PAGESIZE)
-            *((char*)(tmp[i])+j) = 0;
+        if (!own[i])
+            continue;
 
-        // move processor back to original mask
-        err = sched_setaffinity(0, sizeof(cpu_set_t), &cpu_mask_org);
-        if (err) {
-            perror("sched_setaffinity");
-            exit(1);
+        int sampled = 0;
+        int misplaced = shl__check_placement(tmp[i], size, *pagesize,
+                                             args[i].node, &sampled);
+        if (misplaced) {
+            printf(ANSI_COLOR_RED "WARNING:" ANSI_COLOR_RESET
+                   " replica %d: %d of %d sampled pages are not on node %d\n",
+                   i, misplaced, sampled, args[i].node);
+        }
+    }
+
+    // Every entry of the memory information is a full replica; shared
+    // replicas appear only once
+    // --------------------------------------------------
+    struct shl_mi_header *mi = shl__meminfo_alloc(num_own, NULL);
+    mi->map_size = map_size;
+    mi->pagesize = *pagesize;
+    mi->opts = options;
+    for (int i=0, j=0; i<*num_replicas; i++) {
+        if (own[i]) {
+            mi->data[j].vaddr = tmp[i];
+            mi->data[j].size = size;
+            mi->data[j].node = args[i].node;
+            j++;
         }
     }
+
+    if (meminfo) {
+        *meminfo = mi;
+    } else {
+        free(mi);
+    }
+
+    free(threads);
+    free(args);
+    free(reused);
+    free(own);
+
     return tmp;
 }
 
@@ -454,11 +1556,32 @@ bool shl__check_hugepage_support(void)
         return false;
     } else {
         int r = munmap(res, 4096);
-        assert (r);
+        assert (r == 0);
         return true;
     }
 }
 
+/**
+ * \brief returns the size of a cacheline in bytes, CACHELINE if unknown
+ */
+int shl__cacheline_size(void)
+{
+    long size = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
+
+    if (size <= 0) {
+        FILE *f = fopen("/sys/devices/system/cpu/cpu0/cache/index0/"
+                        "coherency_line_size", "r");
+        if (f) {
+            if (fscanf(f, "%ld", &size) != 1) {
+                size = 0;
+            }
+            fclose(f);
+        }
+    }
+
+    return size > 0 ? (int) size : CACHELINE;
+}
+
 
 unsigned long shl__timer_get_timestamp()
 {
@@ -467,124 +1590,14 @@ unsigned long shl__timer_get_timestamp()
     return (TV1.tv_sec * 1000 + TV1.tv_usec/1000);
 }
 
-int shl__memcpy_init(struct shl__memcpy_setup *setup)
-{
-    /* no  op */
-    return 0;
-}
-
-static inline int shl__memcpy_openmp1(uint8_t *dst, uint8_t *src, size_t elements)
-{
-#pragma omp parallel for
-    for (size_t i = 0; i < elements; ++i) {
-        dst[i] = src[i];
-    }
-    return elements;
-}
-static inline int shl__memcpy_openmp2(uint16_t *dst, uint16_t *src, size_t elements)
-{
-#pragma omp parallel for
-    for (size_t i = 0; i < elements; ++i) {
-        dst[i] = src[i];
-    }
-    return elements;
-}
-static inline int shl__memcpy_openmp4(uint32_t *dst, uint32_t *src, size_t elements)
-{
-#pragma omp parallel for
-    for (size_t i = 0; i < elements; ++i) {
-        dst[i] = src[i];
-    }
-    return elements;
-}
-static inline int shl__memcpy_openmp8(uint64_t *dst, uint64_t *src, size_t elements)
-{
-#pragma omp parallel for
-    for (size_t i = 0; i < elements; ++i) {
-        dst[i] = src[i];
-    }
-    return elements;
-}
-
 int shl__memcpy_openmp(void *dst, void *src, size_t element_size, size_t elements)
 {
-    switch(element_size) {
-        case 1:
-            return shl__memcpy_openmp1((uint8_t*)dst, (uint8_t*)src, elements);
-        case 2:
-            return shl__memcpy_openmp2((uint16_t*)dst, (uint16_t*)src, elements);
-        case 4:
-            return shl__memcpy_openmp4((uint32_t*)dst, (uint32_t*)src, elements);
-        case 8:
-            return shl__memcpy_openmp8((uint64_t*)dst, (uint64_t*)src, elements);
-        default:
-            memcpy(dst, src, element_size * elements);
-            return 0;
-    }
-}
-
-static inline int shl__memset_openmp1(uint8_t *dst, uint8_t *value, size_t elements)
-{
-#pragma omp parallel
-    {
-        uint8_t val = *value;
-#pragma omp parallel for
-        for (size_t i = 0; i < elements; ++i) {
-            dst[i] = val;
-        }
-    }
-    return elements;
-}
-static inline int shl__memset_openmp2(uint16_t *dst, uint16_t *value, size_t elements)
-{
-#pragma omp parallel
-    {
-        uint32_t val = *value;
-#pragma omp parallel for
-        for (size_t i = 0; i < elements; ++i) {
-            dst[i] = val;
-        }
-    }
-    return elements;
-}
-static inline int shl__memset_openmp4(uint32_t *dst, uint32_t *value, size_t elements)
-{
-#pragma omp parallel
-    {
-        uint32_t val = *value;
-#pragma omp parallel for
-        for (size_t i = 0; i < elements; ++i) {
-            dst[i] = val;
-        }
-    }
-    return elements;
-}
-static inline int shl__memset_openmp8(uint64_t *dst, uint64_t *value, size_t elements)
-{
-#pragma omp parallel
-    {
-        uint64_t val = *value;
-#pragma omp parallel for
-        for (size_t i = 0; i < elements; ++i) {
-            dst[i] = val;
-        }
-    }
+    shl__memcpy_parallel(dst, src, element_size * elements);
     return elements;
 }
 
 int shl__memset_openmp(void *dst, void *value, size_t element_size, size_t elements)
 {
-    switch(element_size) {
-        case 1:
-            return shl__memset_openmp1((uint8_t*)dst, (uint8_t*)value, elements);
-        case 2:
-            return shl__memset_openmp2((uint16_t*)dst, (uint16_t*)value, elements);
-        case 4:
-            return shl__memset_openmp4((uint32_t*)dst, (uint32_t*)value, elements);
-        case 8:
-            return shl__memset_openmp8((uint64_t*)dst, (uint64_t*)value, elements);
-        default:
-            assert(!"wrong size");
-            return 0;
-    }
+    shl__memset_parallel(dst, value, element_size, element_size * elements);
+    return elements;
 }
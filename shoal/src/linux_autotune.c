@@ -0,0 +1,355 @@
+/*
+ * Copyright (c) 2014 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+/*
+ * Thread count and placement for Linux
+ *
+ * Derived from the topology (see linux_topology.c), so only CPUs the
+ * process may run on are used. Optionally, a short probe measures how
+ * much memory bandwidth a node adds per thread and how much slower
+ * remote memory is, to decide between filling nodes and spreading.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+#include <sched.h>
+#include <numa.h>
+#include <pthread.h>
+#include <omp.h>
+
+#include "shl.h"
+#include "shl_internal.h"
+#include "shl_configuration.hpp"
+
+#define SHL_PROBE_BW_BYTES  (32UL * 1024 * 1024)  ///< buffer per probe thread
+#define SHL_PROBE_LAT_BYTES (16UL * 1024 * 1024)  ///< pointer chase buffer
+#define SHL_PROBE_LAT_STEPS (1UL << 20)
+
+/*
+ * -------------------------------------------------------------------------------
+ * Probe
+ * -------------------------------------------------------------------------------
+ */
+
+struct shl__probe_arg {
+    int cpu;                        ///< CPU to run on
+    pthread_barrier_t *barrier;     ///< start all readers together
+    double gbs;                     ///< returns the bandwidth in GB/s
+};
+
+static void shl__probe_pin(int cpu)
+{
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET(cpu, &mask);
+    pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+}
+
+/**
+ * \brief read a local buffer twice, return the bandwidth of the second pass
+ */
+static void* shl__probe_bw_worker(void *a)
+{
+    struct shl__probe_arg *arg = (struct shl__probe_arg*) a;
+
+    shl__probe_pin(arg->cpu);
+
+    size_t num = SHL_PROBE_BW_BYTES / sizeof(uint64_t);
+    uint64_t *buf = (uint64_t*) numa_alloc_local(SHL_PROBE_BW_BYTES);
+    assert (buf);
+    memset(buf, 1, SHL_PROBE_BW_BYTES);
+
+    volatile uint64_t sink = 0;
+    pthread_barrier_wait(arg->barrier);
+
+    double s = 0;
+    for (int pass=0; pass<2; pass++) {
+        double t = omp_get_wtime();
+        uint64_t sum = 0;
+        for (size_t i=0; i<num; i++) {
+            sum += buf[i];
+        }
+        sink += sum;
+        s = omp_get_wtime() - t;
+    }
+
+    arg->gbs = s > 0 ? SHL_PROBE_BW_BYTES / s / 1e9 : 0;
+
+    numa_free(buf, SHL_PROBE_BW_BYTES);
+    return NULL;
+}
+
+/**
+ * \brief combined read bandwidth of threads on the given CPUs
+ */
+static double shl__probe_bw(const int *cpus, int num)
+{
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, num);
+
+    struct shl__probe_arg *args = (struct shl__probe_arg*)
+        calloc(num, sizeof(struct shl__probe_arg));
+    pthread_t *threads = (pthread_t*) malloc(num * sizeof(pthread_t));
+    assert (args && threads);
+
+    for (int i=0; i<num; i++) {
+        args[i].cpu = cpus[i];
+        args[i].barrier = &barrier;
+        pthread_create(threads + i, NULL, shl__probe_bw_worker, args + i);
+    }
+
+    double gbs = 0;
+    for (int i=0; i<num; i++) {
+        pthread_join(threads[i], NULL);
+        gbs += args[i].gbs;
+    }
+
+    pthread_barrier_destroy(&barrier);
+    free(threads);
+    free(args);
+
+    return gbs;
+}
+
+struct shl__probe_lat_arg {
+    int cpu;
+    int node;                       ///< node of the buffer
+    double ns;                      ///< returns ns per load
+};
+
+/**
+ * \brief chase pointers through a buffer on a node
+ *
+ * The chain visits one cacheline per load in an order the prefetchers
+ * cannot follow.
+ */
+static void* shl__probe_lat_worker(void *a)
+{
+    struct shl__probe_lat_arg *arg = (struct shl__probe_lat_arg*) a;
+
+    shl__probe_pin(arg->cpu);
+
+    size_t lines = SHL_PROBE_LAT_BYTES / CACHELINE;
+    size_t stride = CACHELINE / sizeof(void*);
+    void **buf = (void**) numa_alloc_onnode(SHL_PROBE_LAT_BYTES, arg->node);
+    size_t *order = (size_t*) malloc(lines * sizeof(size_t));
+    assert (buf && order);
+
+    for (size_t i=0; i<lines; i++) {
+        order[i] = i;
+    }
+    unsigned int seed = 1;
+    for (size_t i=lines-1; i>0; i--) {
+        size_t j = rand_r(&seed) % (i+1);
+        size_t tmp = order[i]; order[i] = order[j]; order[j] = tmp;
+    }
+    for (size_t i=0; i<lines; i++) {
+        buf[order[i]*stride] = buf + order[(i+1) % lines]*stride;
+    }
+    free(order);
+
+    void **p = buf;
+    double t = omp_get_wtime();
+    for (size_t i=0; i<SHL_PROBE_LAT_STEPS; i++) {
+        p = (void**) *p;
+    }
+    double s = omp_get_wtime() - t;
+
+    // Keep the chase
+    arg->ns = p ? s * 1e9 / SHL_PROBE_LAT_STEPS : 0;
+
+    numa_free(buf, SHL_PROBE_LAT_BYTES);
+    return NULL;
+}
+
+static double shl__probe_lat(int cpu, int node)
+{
+    struct shl__probe_lat_arg arg = { cpu, node, 0 };
+    pthread_t thread;
+
+    pthread_create(&thread, NULL, shl__probe_lat_worker, &arg);
+    pthread_join(thread, NULL);
+
+    return arg.ns;
+}
+
+/**
+ * \brief decide whether to fill nodes before using the next one
+ *
+ * Spreading pays off if a node's memory bandwidth saturates before
+ * all its cores are busy, and remote memory is noticeably slower
+ * (so data should stay on the node of the threads using it, which
+ * shoal's placement does). Otherwise, keeping threads together makes
+ * sharing and barriers cheaper.
+ *
+ * \param cores one CPU per core of the first node
+ */
+static bool shl__probe_fill(const int *cores, int num_cores, int node, int remote)
+{
+    double single = shl__probe_bw(cores, 1);
+    double all = num_cores > 1 ? shl__probe_bw(cores, num_cores) : single;
+    double scaling = single > 0 ? all / (single * num_cores) : 1;
+
+    double ratio = 1;
+    if (remote >= 0) {
+        double local = shl__probe_lat(cores[0], node);
+        ratio = local > 0 ? shl__probe_lat(cores[0], remote) / local : 1;
+    }
+
+    bool fill = scaling > 0.5 || ratio < 1.2;
+
+    printf("autotune: node %d: %.1f GB/s per thread, %.1f GB/s with %d "
+           "threads, remote latency %.2fx -> %s\n", node, single, all,
+           num_cores, ratio, fill ? "fill" : "spread");
+
+    return fill;
+}
+
+/*
+ * -------------------------------------------------------------------------------
+ * Placement
+ * -------------------------------------------------------------------------------
+ */
+
+/**
+ * \brief candidate CPUs of a node, one hardware thread per core first
+ *
+ * The hardware thread representing a core is its lowest usable one.
+ *
+ * \returns the number of candidates written to res
+ */
+static int shl__tune_candidates(int node, bool cores_only, int *res)
+{
+    const int *cpus;
+    int num = shl__topo_node_cpus(node, &cpus);
+    int n = 0;
+
+    for (int pass=0; pass<(cores_only ? 1 : 2); pass++) {
+        for (int i=0; i<num; i++) {
+
+            bool first = true;
+            for (int j=0; j<i && first; j++) {
+                first = shl__topo_cpu_core(cpus[j]) != shl__topo_cpu_core(cpus[i]);
+            }
+
+            if (first == (pass == 0)) {
+                res[n++] = cpus[i];
+            }
+        }
+    }
+
+    return n;
+}
+
+/**
+ * \brief Find sensible thread placement.
+ *
+ * With barriers, one thread runs on every physical core, without, one
+ * on every hardware context. Threads either fill a node (cores before
+ * SMT siblings) before continuing on the nearest one, or are spread
+ * round robin over all nodes. Configured by global.autotune_fill:
+ * 1 fills, 0 spreads, -1 (default) fills if the probe suggests so
+ * (global.autotune = 2), and spreads otherwise.
+ *
+ * \param num_cores upper limit of the number of threads, <= 0 for no
+ *     limit; returns the number of threads to use
+ * \param bind returns the CPU of every thread, must have room for
+ *     the limit, or for shl__topo_allowed_cpus() CPUs if there is none.
+ *     May be NULL to only obtain the number of threads.
+ * \param uses_barriers whether the threads synchronize with barriers
+ */
+void shl__auto_tune_bind(int *num_cores,
+                         coreid_t *bind,
+                         bool uses_barriers)
+{
+    Configuration *conf = get_conf();
+
+    int num_nodes = shl__max_node() + 1;
+    int num_cpus = shl__topo_allowed_cpus(NULL);
+
+    int *cand = (int*) malloc(sizeof(int) * num_cpus);
+    int *first = (int*) calloc(num_nodes + 1, sizeof(int));
+    assert (cand && first);
+
+    // Nodes without usable CPUs have no candidates
+    int total = 0;
+    for (int node=0; node<num_nodes; node++) {
+        first[node] = total;
+        total += shl__tune_candidates(node, uses_barriers, cand + total);
+    }
+    first[num_nodes] = total;
+    assert (total > 0);
+
+    int num = *num_cores > 0 && *num_cores < total ? *num_cores : total;
+
+    // Start on the node with the lowest usable CPU, in order of distance
+    int start = 0;
+    while (first[start+1] == first[start]) {
+        start++;
+    }
+
+    int *nodes = (int*) malloc(sizeof(int) * num_nodes);
+    assert (nodes);
+    int num_used = 0;
+    for (int node=0; node<num_nodes; node++) {
+        if (first[node+1] > first[node]) {
+            nodes[num_used++] = node;
+        }
+    }
+    for (int i=1; i<num_used; i++) {
+        for (int j=i; j>0 && shl__node_distance(start, nodes[j]) <
+                 shl__node_distance(start, nodes[j-1]); j--) {
+            int tmp = nodes[j]; nodes[j] = nodes[j-1]; nodes[j-1] = tmp;
+        }
+    }
+
+    bool fill = false;
+    if (conf->auto_tune_fill >= 0) {
+        fill = conf->auto_tune_fill;
+    } else if (conf->auto_tune > 1 && num_used > 1 && num < total) {
+        int *cores = (int*) malloc(sizeof(int) * num_cpus);
+        assert (cores);
+        int n = shl__tune_candidates(start, true, cores);
+        fill = shl__probe_fill(cores, n, start, nodes[1]);
+        free(cores);
+    }
+
+    if (bind) {
+        int i = 0;
+        if (fill) {
+            for (int k=0; k<num_used && i<num; k++) {
+                for (int c=first[nodes[k]]; c<first[nodes[k]+1] && i<num; c++) {
+                    bind[i++] = cand[c];
+                }
+            }
+        } else {
+            for (int round=0; i<num; round++) {
+                for (int k=0; k<num_used && i<num; k++) {
+                    int c = first[nodes[k]] + round;
+                    if (c < first[nodes[k]+1]) {
+                        bind[i++] = cand[c];
+                    }
+                }
+            }
+        }
+    }
+
+    printf("autotune: %d threads, one per %s, %s\n", num,
+           uses_barriers ? "core" : "hardware thread",
+           fill ? "filling nodes" : "spread over nodes");
+
+    *num_cores = num;
+
+    free(nodes);
+    free(first);
+    free(cand);
+}
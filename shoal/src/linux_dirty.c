@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) 2014 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+/*
+ * Dirty page tracking for Linux
+ *
+ * Tracked regions are write protected. The first write to a page
+ * raises SIGSEGV, the handler marks the page dirty and makes it
+ * writable again, so every page faults at most once between two
+ * collections. Collecting re-protects the dirty pages.
+ *
+ * Every call to shl__dirty_track returns its own handle, so several
+ * users can track the same memory independently: a fault marks the
+ * page dirty in all regions containing it.
+ *
+ * Caveat: protection applies to whole pages, including memory next to
+ * a region that shares its first or last page. The kernel does not
+ * raise a signal for writes from system calls (e.g. read(2) into a
+ * tracked page), those fail with EFAULT instead. Tracking is hence
+ * only enabled with global.dirty (SHL_DIRTY=1).
+ */
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "shl.h"
+
+#define SHL_DIRTY_MAX_REGIONS 64
+
+/**
+ * \brief a tracked region
+ *
+ * Pages are those of the system page size overlapping the region.
+ */
+struct shl__dirty_region {
+    char *addr;                 ///< start of the region as given
+    size_t size;                ///< size of the region as given
+    char *start;                ///< first page
+    size_t num_pages;           ///< number of pages
+    volatile uint8_t *dirty;    ///< one flag per page
+    volatile int active;        ///< slot in use
+};
+
+static struct shl__dirty_region dirty_regions[SHL_DIRTY_MAX_REGIONS];
+static pthread_mutex_t dirty_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sigaction dirty_old_action;
+static bool dirty_handler_installed = false;
+static size_t dirty_pagesize = 0;
+
+/**
+ * \brief Mark the page holding addr dirty in all regions containing it
+ *
+ * \returns whether any region contains the page
+ */
+static bool shl__dirty_mark(char *addr)
+{
+    bool found = false;
+
+    for (int i=0; i<SHL_DIRTY_MAX_REGIONS; i++) {
+
+        struct shl__dirty_region *r = dirty_regions + i;
+        if (!r->active || addr < r->start ||
+            addr >= r->start + r->num_pages*dirty_pagesize) {
+            continue;
+        }
+
+        size_t page = (addr - r->start) / dirty_pagesize;
+        if (!r->dirty[page]) {
+            r->dirty[page] = 1;
+        }
+        found = true;
+    }
+
+    return found;
+}
+
+/**
+ * \brief SIGSEGV handler
+ *
+ * Only uses async-signal-safe functions. Faults outside of tracked
+ * regions are forwarded to the previous handler.
+ *
+ * A collection may clear the flag and protect the page again between
+ * marking and unprotecting it here. The flag is hence set again after
+ * unprotecting, so that a writable page is always marked dirty.
+ */
+static void shl__dirty_handler(int sig, siginfo_t *si, void *ctx)
+{
+    char *fault = (char*) si->si_addr;
+
+    if (shl__dirty_mark(fault)) {
+        char *page = (char*) ((uintptr_t) fault & ~(dirty_pagesize-1));
+        mprotect(page, dirty_pagesize, PROT_READ | PROT_WRITE);
+        __sync_synchronize();
+        shl__dirty_mark(fault);
+        return;
+    }
+
+    // Not ours
+    if (dirty_old_action.sa_flags & SA_SIGINFO) {
+        dirty_old_action.sa_sigaction(sig, si, ctx);
+    } else if (dirty_old_action.sa_handler != SIG_DFL &&
+               dirty_old_action.sa_handler != SIG_IGN) {
+        dirty_old_action.sa_handler(sig);
+    } else {
+        // Restore the default action; the fault repeats and terminates
+        signal(SIGSEGV, SIG_DFL);
+    }
+}
+
+/**
+ * \brief Allocate the dirty flags of a region
+ *
+ * The flags are written by the signal handler, so they must not share
+ * a page with any tracked region (which heap memory could).
+ */
+static volatile uint8_t* shl__dirty_flags_alloc(size_t num_pages)
+{
+    void *flags = mmap(NULL, num_pages, PROT_READ | PROT_WRITE,
+                       MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+
+    return flags == MAP_FAILED ? NULL : (volatile uint8_t*) flags;
+}
+
+static void shl__dirty_flags_free(struct shl__dirty_region *r)
+{
+    munmap((void*) r->dirty, r->num_pages);
+    r->dirty = NULL;
+}
+
+/**
+ * \brief Start tracking writes to a region
+ *
+ * The region is assumed to be clean, i.e. identical to its replicas.
+ * The region has to stay mapped until shl__dirty_untrack.
+ *
+ * \returns a handle for shl__dirty_collect and shl__dirty_untrack, or
+ *     NULL if the region cannot be tracked
+ */
+struct shl__dirty_region* shl__dirty_track(void *addr, size_t size)
+{
+    if (addr == NULL || size == 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&dirty_lock);
+
+    if (!dirty_handler_installed) {
+
+        dirty_pagesize = sysconf(_SC_PAGESIZE);
+
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = shl__dirty_handler;
+        sa.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+
+        if (sigaction(SIGSEGV, &sa, &dirty_old_action)) {
+            perror("sigaction");
+            pthread_mutex_unlock(&dirty_lock);
+            return NULL;
+        }
+
+        dirty_handler_installed = true;
+    }
+
+    struct shl__dirty_region *r = NULL;
+    for (int i=0; i<SHL_DIRTY_MAX_REGIONS && r == NULL; i++) {
+        if (!dirty_regions[i].active && dirty_regions[i].dirty == NULL) {
+            r = dirty_regions + i;
+        }
+    }
+
+    if (r == NULL) {
+        pthread_mutex_unlock(&dirty_lock);
+        return NULL;
+    }
+
+    uintptr_t first = (uintptr_t) addr & ~(dirty_pagesize-1);
+    uintptr_t last = ((uintptr_t) addr + size + dirty_pagesize - 1)
+        & ~(dirty_pagesize-1);
+
+    r->addr = (char*) addr;
+    r->size = size;
+    r->start = (char*) first;
+    r->num_pages = (last - first) / dirty_pagesize;
+    r->dirty = shl__dirty_flags_alloc(r->num_pages);
+    if (r->dirty == NULL) {
+        pthread_mutex_unlock(&dirty_lock);
+        return NULL;
+    }
+
+    if (mprotect(r->start, r->num_pages*dirty_pagesize, PROT_READ)) {
+        // e.g. huge pages not aligned to the system page size
+        shl__dirty_flags_free(r);
+        pthread_mutex_unlock(&dirty_lock);
+        return NULL;
+    }
+
+    __sync_synchronize();
+    r->active = 1;
+
+    pthread_mutex_unlock(&dirty_lock);
+
+    return r;
+}
+
+/**
+ * \brief Stop tracking writes to a region
+ *
+ * Pages also contained in other tracked regions stay protected.
+ */
+void shl__dirty_untrack(struct shl__dirty_region *r)
+{
+    if (r == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&dirty_lock);
+
+    assert (r->active);
+    r->active = 0;
+    __sync_synchronize();
+
+    mprotect(r->start, r->num_pages*dirty_pagesize, PROT_READ | PROT_WRITE);
+
+    for (int i=0; i<SHL_DIRTY_MAX_REGIONS; i++) {
+
+        struct shl__dirty_region *o = dirty_regions + i;
+        if (!o->active) {
+            continue;
+        }
+
+        char *from = o->start > r->start ? o->start : r->start;
+        char *to_o = o->start + o->num_pages*dirty_pagesize;
+        char *to_r = r->start + r->num_pages*dirty_pagesize;
+        char *to = to_o < to_r ? to_o : to_r;
+
+        // Pages writable for o are marked dirty in o already
+        if (from < to) {
+            mprotect(from, to - from, PROT_READ);
+        }
+    }
+
+    shl__dirty_flags_free(r);
+
+    pthread_mutex_unlock(&dirty_lock);
+}
+
+/**
+ * \brief Return parts of a region written since the last collection
+ *
+ * Dirty pages are write protected again before returning, so writes
+ * that happen while the returned parts are being copied are seen by
+ * the next collection.
+ *
+ * \param r    handle returned by shl__dirty_track, may be NULL
+ * \param runs returns an array of byte ranges relative to the start of
+ *     the region, to be freed by the caller
+ *
+ * \returns the number of ranges, -1 if r is NULL
+ */
+long shl__dirty_collect(struct shl__dirty_region *r, struct shl__range **runs)
+{
+    if (r == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&dirty_lock);
+
+    size_t num_runs = 0;
+    size_t max_runs = 16;
+    struct shl__range *res = (struct shl__range*)
+        malloc(max_runs * sizeof(struct shl__range));
+    assert (res);
+
+    size_t p = 0;
+    while (p < r->num_pages) {
+
+        if (!r->dirty[p]) {
+            p++;
+            continue;
+        }
+
+        size_t first = p;
+        while (p < r->num_pages && r->dirty[p]) {
+            r->dirty[p] = 0;
+            p++;
+        }
+
+        // Re-arm before the caller copies
+        char *start = r->start + first*dirty_pagesize;
+        mprotect(start, (p-first)*dirty_pagesize, PROT_READ);
+
+        // Clip to the region
+        char *from = start < r->addr ? r->addr : start;
+        char *to = r->start + p*dirty_pagesize;
+        if (to > r->addr + r->size)
+            to = r->addr + r->size;
+
+        if (num_runs == max_runs) {
+            max_runs *= 2;
+            res = (struct shl__range*)
+                realloc(res, max_runs * sizeof(struct shl__range));
+            assert (res);
+        }
+
+        res[num_runs].offset = from - r->addr;
+        res[num_runs].size = to - from;
+        num_runs++;
+    }
+
+    pthread_mutex_unlock(&dirty_lock);
+
+    *runs = res;
+    return num_runs;
+}
@@ -0,0 +1,413 @@
+/*
+ * Copyright (c) 2014 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+/*
+ * Software DMA engine for Linux
+ *
+ * Linux has no portable interface to the DMA engines available on some
+ * platforms. Instead, copy threads (memcpy_setup.count per node) are
+ * pinned to every NUMA node and work on queues of copy requests. A
+ * request is executed by the threads of the node its destination is
+ * on, so writes are always local. Completion is signaled by
+ * incrementing the counter given on submission, just like the
+ * Barrelfish DMA callbacks do, so arrays can overlap copying with
+ * computation and wait in copy_barrier.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+#include <sched.h>
+#include <numa.h>
+#include <pthread.h>
+
+#include "shl_internal.h"
+#include "shl.h"
+#include "backend/linux/meminfo.h"
+
+enum shl__dma_type {
+    SHL_DMA_COPY,
+    SHL_DMA_SET
+};
+
+/**
+ * \brief a single copy request
+ */
+struct shl__dma_request {
+    enum shl__dma_type type;
+    char *dst;                      ///< destination
+    const char *src;                ///< source (SHL_DMA_COPY only)
+    uint64_t value;                 ///< value (SHL_DMA_SET only)
+    size_t bytes;                   ///< number of bytes to copy
+    size_t *counter;                ///< incremented on completion
+    struct shl__dma_request *next;
+};
+
+/**
+ * \brief request queue of one node
+ */
+struct shl__dma_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct shl__dma_request *head;
+    struct shl__dma_request *tail;
+    int node;
+    bool stop;                      ///< workers exit once the queue is empty
+    pthread_t *threads;             ///< copy threads of the node
+    uint32_t num_threads;
+};
+
+static struct shl__dma_queue *dma_queues = NULL;
+static int dma_num_queues = 0;
+static int dma_next_queue = 0;
+
+/*
+ * -------------------------------------------------------------------------------
+ * Copy threads
+ * -------------------------------------------------------------------------------
+ */
+
+static void* shl__dma_worker(void *arg)
+{
+    struct shl__dma_queue *q = (struct shl__dma_queue*) arg;
+
+    numa_run_on_node(q->node);
+
+    while (true) {
+
+        pthread_mutex_lock(&q->lock);
+        while (q->head == NULL && !q->stop) {
+            pthread_cond_wait(&q->cond, &q->lock);
+        }
+        if (q->head == NULL) {
+            pthread_mutex_unlock(&q->lock);
+            break;
+        }
+        struct shl__dma_request *req = q->head;
+        q->head = req->next;
+        if (q->head == NULL) {
+            q->tail = NULL;
+        }
+        pthread_mutex_unlock(&q->lock);
+
+        switch (req->type) {
+        case SHL_DMA_COPY:
+            shl__memcpy_simd(req->dst, req->src, req->bytes, true);
+            break;
+        case SHL_DMA_SET:
+            shl__memset_simd(req->dst, &req->value, sizeof(uint64_t),
+                             req->bytes, true);
+            break;
+        }
+
+        __sync_fetch_and_add(req->counter, 1);
+        free(req);
+    }
+
+    return NULL;
+}
+
+/**
+ * \brief Stop and join the copy threads of the given queues, and free
+ * the queues
+ */
+static void shl__dma_stop(struct shl__dma_queue *queues, int num_queues)
+{
+    for (int i=0; i<num_queues; i++) {
+
+        struct shl__dma_queue *q = queues + i;
+
+        pthread_mutex_lock(&q->lock);
+        q->stop = true;
+        pthread_cond_broadcast(&q->cond);
+        pthread_mutex_unlock(&q->lock);
+
+        for (uint32_t t=0; t<q->num_threads; t++) {
+            pthread_join(q->threads[t], NULL);
+        }
+
+        free(q->threads);
+        pthread_mutex_destroy(&q->lock);
+        pthread_cond_destroy(&q->cond);
+    }
+
+    free(queues);
+}
+
+/**
+ * \brief starts the copy threads
+ *
+ * \param setup setup->count is the number of copy threads per node
+ *
+ * \returns 0 on success
+ */
+int shl__memcpy_init(struct shl__memcpy_setup *setup)
+{
+    if (dma_queues) {
+        return 0;
+    }
+
+    if (setup->count == 0) {
+        return -1;
+    }
+
+    int max_node = numa_max_node();
+    struct shl__dma_queue *queues = (struct shl__dma_queue*)
+        calloc(max_node+1, sizeof(struct shl__dma_queue));
+    if (queues == NULL) {
+        return -1;
+    }
+
+    int num_queues = 0;
+    for (int node=0; node<=max_node; node++) {
+
+        if (!numa_bitmask_isbitset(numa_all_nodes_ptr, node)) {
+            continue;
+        }
+
+        struct shl__dma_queue *q = queues + num_queues;
+        pthread_mutex_init(&q->lock, NULL);
+        pthread_cond_init(&q->cond, NULL);
+        q->node = node;
+        num_queues++;
+
+        q->threads = (pthread_t*) calloc(setup->count, sizeof(pthread_t));
+        if (q->threads == NULL) {
+            shl__dma_stop(queues, num_queues);
+            return -1;
+        }
+
+        for (uint32_t i=0; i<setup->count; i++) {
+
+            int err = pthread_create(q->threads + i, NULL, shl__dma_worker, q);
+            if (err) {
+                printf(ANSI_COLOR_YELLOW "WARNING:" ANSI_COLOR_RESET
+                       " could not start copy thread on node %d: %s\n",
+                       node, strerror(err));
+                shl__dma_stop(queues, num_queues);
+                return -1;
+            }
+            q->num_threads++;
+        }
+    }
+
+    // The threads run until the process exits
+    for (int i=0; i<num_queues; i++) {
+        for (uint32_t t=0; t<queues[i].num_threads; t++) {
+            pthread_detach(queues[i].threads[t]);
+        }
+    }
+
+    SHL_DEBUG_PRINT("DMA: %u copy threads on each of %d nodes\n",
+                    setup->count, num_queues);
+
+    dma_num_queues = num_queues;
+    dma_queues = queues;
+
+    return 0;
+}
+
+/**
+ * \brief returns the queue of the given node, or the next one in
+ * round robin order if the node is not known
+ */
+static struct shl__dma_queue* shl__dma_queue_for(int node)
+{
+    for (int i=0; node>=0 && i<dma_num_queues; i++) {
+        if (dma_queues[i].node == node) {
+            return dma_queues + i;
+        }
+    }
+
+    int i = __sync_fetch_and_add(&dma_next_queue, 1);
+    return dma_queues + (i % dma_num_queues);
+}
+
+/**
+ * \brief issues requests for bytes at dst, split in requests of at
+ * most SHL_DMA_REQUEST_SIZE bytes
+ *
+ * \returns number of requests issued
+ */
+static size_t shl__dma_submit(enum shl__dma_type type, int node, char *dst,
+                              const char *src, uint64_t value, size_t bytes,
+                              size_t *counter)
+{
+    size_t count = 0;
+
+    for (size_t offset=0; offset<bytes; offset+=SHL_DMA_REQUEST_SIZE) {
+
+        struct shl__dma_request *req = (struct shl__dma_request*)
+            malloc(sizeof(struct shl__dma_request));
+        assert (req);
+
+        req->type = type;
+        req->dst = dst + offset;
+        req->src = src ? src + offset : NULL;
+        req->value = value;
+        req->bytes = bytes - offset < SHL_DMA_REQUEST_SIZE ?
+            bytes - offset : SHL_DMA_REQUEST_SIZE;
+        req->counter = counter;
+        req->next = NULL;
+
+        struct shl__dma_queue *q = shl__dma_queue_for(node);
+
+        pthread_mutex_lock(&q->lock);
+        if (q->tail) {
+            q->tail->next = req;
+        } else {
+            q->head = req;
+        }
+        q->tail = req;
+        pthread_cond_signal(&q->cond);
+        pthread_mutex_unlock(&q->lock);
+
+        count++;
+    }
+
+    return count;
+}
+
+/**
+ * \brief the copy threads complete requests on their own
+ */
+int shl__memcpy_poll(void)
+{
+    sched_yield();
+    return 0;
+}
+
+/*
+ * -------------------------------------------------------------------------------
+ * Walking the memory information of an array
+ * -------------------------------------------------------------------------------
+ */
+
+/**
+ * \brief address of byte offset of an array
+ *
+ * For replicated arrays, the replica on the given node is preferred.
+ */
+static char* shl__mi_addr(struct shl_mi_header *mi, size_t offset, int node)
+{
+    if (mi->vaddr) {
+        return (char*) mi->vaddr + offset;
+    }
+
+    for (size_t i=0; i<mi->num; i++) {
+        if (mi->data[i].node == node) {
+            return (char*) mi->data[i].vaddr + offset;
+        }
+    }
+
+    return (char*) mi->data[0].vaddr + offset;
+}
+
+struct shl__dma_arg {
+    const char *src;                ///< contiguous source, or NULL
+    struct shl_mi_header *mi_src;   ///< source array, if src is NULL
+    uint64_t value;
+    size_t *counter;
+};
+
+static size_t shl__dma_copy_part(char *addr, size_t offset, size_t bytes,
+                                 int node, void *arg)
+{
+    struct shl__dma_arg *a = (struct shl__dma_arg*) arg;
+    const char *src = a->src ? a->src + offset
+        : shl__mi_addr(a->mi_src, offset, node);
+
+    return shl__dma_submit(SHL_DMA_COPY, node, addr, src, 0, bytes, a->counter);
+}
+
+static size_t shl__dma_set_part(char *addr, size_t offset, size_t bytes,
+                                int node, void *arg)
+{
+    struct shl__dma_arg *a = (struct shl__dma_arg*) arg;
+
+    return shl__dma_submit(SHL_DMA_SET, node, addr, NULL, a->value, bytes,
+                           a->counter);
+}
+
+static size_t shl__dma_to_part(char *addr, size_t offset, size_t bytes,
+                               int node, void *arg)
+{
+    struct shl__dma_arg *a = (struct shl__dma_arg*) arg;
+
+    // The destination is plain memory: execute on the source's node
+    return shl__dma_submit(SHL_DMA_COPY, node, (char*) a->src + offset, addr,
+                           0, bytes, a->counter);
+}
+
+/*
+ * -------------------------------------------------------------------------------
+ * Copying from and to arrays
+ *
+ * All functions return the number of requests issued; the counter
+ * tx_compl reaches this number once all of them completed. 0 means
+ * that nothing has been copied.
+ * -------------------------------------------------------------------------------
+ */
+
+size_t shl__memcpy_dma_from(void *va_src, void *mi_dst, size_t size, size_t *tx_compl)
+{
+    if (dma_queues == NULL || mi_dst == NULL || size == 0) {
+        return 0;
+    }
+
+    struct shl__dma_arg arg = { (const char*) va_src, NULL, 0, tx_compl };
+
+    return shl__mi_foreach((struct shl_mi_header*) mi_dst, size,
+                           shl__dma_copy_part, &arg);
+}
+
+size_t shl__memcpy_dma_to(void *mi_src, void *va_dst, size_t size, size_t *tx_compl)
+{
+    if (dma_queues == NULL || mi_src == NULL || size == 0) {
+        return 0;
+    }
+
+    struct shl_mi_header *mi = (struct shl_mi_header*) mi_src;
+    struct shl__dma_arg arg = { (const char*) va_dst, NULL, 0, tx_compl };
+
+    if (mi->vaddr == NULL) {
+        // Copy back from the first replica only
+        struct shl_mi_header first = *mi;
+        first.num = 1;
+        return shl__mi_foreach(&first, size, shl__dma_to_part, &arg);
+    }
+
+    return shl__mi_foreach(mi, size, shl__dma_to_part, &arg);
+}
+
+size_t shl__memcpy_dma_array(void *mi_src, void *mi_dst, size_t size, size_t *tx_compl)
+{
+    if (dma_queues == NULL || mi_src == NULL || mi_dst == NULL || size == 0) {
+        return 0;
+    }
+
+    struct shl__dma_arg arg = { NULL, (struct shl_mi_header*) mi_src, 0, tx_compl };
+
+    return shl__mi_foreach((struct shl_mi_header*) mi_dst, size,
+                           shl__dma_copy_part, &arg);
+}
+
+size_t shl__memset_dma(void *mi_dst, uint64_t value, size_t size, size_t *tx_compl)
+{
+    if (dma_queues == NULL || mi_dst == NULL || size == 0) {
+        return 0;
+    }
+
+    struct shl__dma_arg arg = { NULL, NULL, value, tx_compl };
+
+    return shl__mi_foreach((struct shl_mi_header*) mi_dst, size,
+                           shl__dma_set_part, &arg);
+}
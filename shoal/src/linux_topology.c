@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2014 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+/*
+ * Machine topology for Linux
+ *
+ * Read once from libnuma, sysfs and the affinity mask of the process,
+ * so that later queries are table lookups. Only CPUs in the affinity
+ * mask of the process at shl__topo_init (i.e. of its cgroup cpuset,
+ * unless restricted further) are considered usable.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sched.h>
+#include <numa.h>
+
+#include "shl.h"
+
+struct shl__topology {
+    int num_cpus;       ///< number of configured CPUs
+    int num_nodes;      ///< highest node + 1
+    int *cpu_node;      ///< node of every CPU
+    int *cpu_core;      ///< lowest CPU among the SMT siblings of every CPU
+    int *cpu_llc;       ///< lowest CPU sharing the last-level cache
+    bool *cpu_allowed;  ///< whether the process may run on the CPU
+    int *allowed;       ///< usable CPUs, one hardware thread per core first
+    int num_allowed;
+    int *node_cpus;     ///< usable CPUs grouped by node
+    int *node_first;    ///< index of the first CPU of node n in node_cpus
+    int *distance;      ///< num_nodes x num_nodes distance matrix
+};
+
+static struct shl__topology *topo = NULL;
+
+/**
+ * \brief read the first number from a sysfs file of a CPU
+ *
+ * CPU lists in sysfs are sorted, so for lists this is the lowest CPU.
+ *
+ * \returns the number, or dflt if the file cannot be read
+ */
+static int shl__topo_read_first(int cpu, const char *file, int dflt)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, file);
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return dflt;
+    }
+
+    int res;
+    if (fscanf(f, "%d", &res) != 1) {
+        res = dflt;
+    }
+    fclose(f);
+
+    return res;
+}
+
+/**
+ * \brief lowest CPU sharing the highest level of cache with cpu
+ */
+static int shl__topo_read_llc(int cpu)
+{
+    int llc = cpu;
+    int max_level = 0;
+
+    for (int idx=0; ; idx++) {
+
+        char file[64];
+        snprintf(file, sizeof(file), "cache/index%d/level", idx);
+        int level = shl__topo_read_first(cpu, file, -1);
+        if (level < 0) {
+            break;
+        }
+
+        if (level > max_level) {
+            snprintf(file, sizeof(file), "cache/index%d/shared_cpu_list", idx);
+            llc = shl__topo_read_first(cpu, file, cpu);
+            max_level = level;
+        }
+    }
+
+    return llc;
+}
+
+/**
+ * \brief build the topology tables
+ *
+ * Called by shl__init. Calling it again re-reads the affinity mask.
+ */
+void shl__topo_init(void)
+{
+    struct shl__topology *t = (struct shl__topology*)
+        calloc(1, sizeof(struct shl__topology));
+    assert (t);
+
+    t->num_cpus = numa_num_configured_cpus();
+    t->num_nodes = numa_max_node() + 1;
+
+    t->cpu_node = (int*) malloc(sizeof(int) * t->num_cpus);
+    t->cpu_core = (int*) malloc(sizeof(int) * t->num_cpus);
+    t->cpu_llc = (int*) malloc(sizeof(int) * t->num_cpus);
+    t->cpu_allowed = (bool*) calloc(t->num_cpus, sizeof(bool));
+    t->allowed = (int*) malloc(sizeof(int) * t->num_cpus);
+    t->node_cpus = (int*) malloc(sizeof(int) * t->num_cpus);
+    t->node_first = (int*) calloc(t->num_nodes + 1, sizeof(int));
+    t->distance = (int*) malloc(sizeof(int) * t->num_nodes * t->num_nodes);
+    assert (t->cpu_node && t->cpu_core && t->cpu_llc && t->cpu_allowed &&
+            t->allowed && t->node_cpus && t->node_first && t->distance);
+
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    bool have_mask = sched_getaffinity(0, sizeof(mask), &mask) == 0;
+
+    for (int cpu=0; cpu<t->num_cpus; cpu++) {
+
+        int node = numa_node_of_cpu(cpu);
+        t->cpu_node[cpu] = node < 0 ? 0 : node;
+        t->cpu_core[cpu] = shl__topo_read_first(cpu, "topology/thread_siblings_list", cpu);
+        t->cpu_llc[cpu] = shl__topo_read_llc(cpu);
+        t->cpu_allowed[cpu] = node >= 0 &&
+            (!have_mask || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &mask)));
+    }
+
+    // First hardware thread of every core, then the remaining siblings
+    for (int pass=0; pass<2; pass++) {
+        for (int cpu=0; cpu<t->num_cpus; cpu++) {
+            if (t->cpu_allowed[cpu] && (t->cpu_core[cpu] == cpu) == (pass == 0)) {
+                t->allowed[t->num_allowed++] = cpu;
+            }
+        }
+    }
+
+    // Usable CPUs by node, in ascending order
+    for (int cpu=0; cpu<t->num_cpus; cpu++) {
+        if (t->cpu_allowed[cpu]) {
+            t->node_first[t->cpu_node[cpu] + 1]++;
+        }
+    }
+    for (int n=0; n<t->num_nodes; n++) {
+        t->node_first[n+1] += t->node_first[n];
+    }
+    int *fill = (int*) malloc(sizeof(int) * t->num_nodes);
+    assert (fill);
+    memcpy(fill, t->node_first, sizeof(int) * t->num_nodes);
+    for (int cpu=0; cpu<t->num_cpus; cpu++) {
+        if (t->cpu_allowed[cpu]) {
+            t->node_cpus[fill[t->cpu_node[cpu]]++] = cpu;
+        }
+    }
+    free(fill);
+
+    for (int a=0; a<t->num_nodes; a++) {
+        for (int b=0; b<t->num_nodes; b++) {
+            int d = numa_distance(a, b);
+            if (d <= 0) {
+                // No distance information available
+                d = a == b ? 10 : 20;
+            }
+            t->distance[a * t->num_nodes + b] = d;
+        }
+    }
+
+    SHL_DEBUG_PRINT("topology: %d CPUs, %d usable, %d nodes\n",
+                    t->num_cpus, t->num_allowed, t->num_nodes);
+
+    // Tables of a previous call are leaked, threads may still read them
+    topo = t;
+}
+
+/**
+ * \brief returns whether the topology tables have been built
+ */
+bool shl__topo_ready(void)
+{
+    return topo != NULL;
+}
+
+int shl__topo_num_cpus(void)
+{
+    return topo->num_cpus;
+}
+
+/**
+ * \brief returns the node of a CPU
+ */
+int shl__topo_cpu_node(int cpu)
+{
+    assert (cpu >= 0 && cpu < topo->num_cpus);
+    return topo->cpu_node[cpu];
+}
+
+/**
+ * \brief returns the core of a CPU, i.e. the lowest of its SMT siblings
+ */
+int shl__topo_cpu_core(int cpu)
+{
+    assert (cpu >= 0 && cpu < topo->num_cpus);
+    return topo->cpu_core[cpu];
+}
+
+/**
+ * \brief returns the last-level cache domain of a CPU, i.e. the lowest
+ * CPU sharing that cache
+ */
+int shl__topo_cpu_llc(int cpu)
+{
+    assert (cpu >= 0 && cpu < topo->num_cpus);
+    return topo->cpu_llc[cpu];
+}
+
+/**
+ * \brief returns whether the process may run on a CPU
+ */
+bool shl__topo_cpu_allowed(int cpu)
+{
+    return cpu >= 0 && cpu < topo->num_cpus && topo->cpu_allowed[cpu];
+}
+
+/**
+ * \brief returns the CPUs the process may run on
+ *
+ * One hardware thread of every core comes first, followed by the
+ * remaining SMT siblings, each in ascending order.
+ *
+ * \param cpus returns the CPUs, may be NULL
+ *
+ * \returns the number of CPUs
+ */
+int shl__topo_allowed_cpus(const int **cpus)
+{
+    if (cpus) {
+        *cpus = topo->allowed;
+    }
+    return topo->num_allowed;
+}
+
+/**
+ * \brief returns the CPUs of a node the process may run on
+ *
+ * \param cpus returns the CPUs in ascending order, may be NULL
+ *
+ * \returns the number of CPUs
+ */
+int shl__topo_node_cpus(int node, const int **cpus)
+{
+    if (node < 0 || node >= topo->num_nodes) {
+        return 0;
+    }
+
+    if (cpus) {
+        *cpus = topo->node_cpus + topo->node_first[node];
+    }
+    return topo->node_first[node+1] - topo->node_first[node];
+}
+
+/**
+ * \brief returns the distance between two nodes, 10 for the same node
+ *
+ * Nodes that do not exist (e.g. replicas emulated with SHL_NUMA_TRIM
+ * or more replicas than nodes) are treated like numa_distance does
+ * for missing information.
+ */
+int shl__topo_node_distance(int node_a, int node_b)
+{
+    if (node_a < 0 || node_a >= topo->num_nodes ||
+        node_b < 0 || node_b >= topo->num_nodes) {
+        return node_a == node_b ? 10 : 20;
+    }
+    return topo->distance[node_a * topo->num_nodes + node_b];
+}
@@ -12,8 +12,16 @@
 
 Timer shl__default_timer;
 
-// virtually indexed
-int replica_lookup[MAXCORES];
+// virtually indexed, shl__max_threads() entries
+int *replica_lookup = NULL;
+
+// incremented whenever cached replica pointers become stale
+unsigned long replica_epoch = 0;
+
+#ifndef BARRELFISH
+// same, for the pointers cached by one thread only
+__thread unsigned long replica_thread_epoch = 0;
+#endif
 
 
 
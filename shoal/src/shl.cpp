@@ -21,6 +21,8 @@ extern "C" {
 
 #ifndef BARRELFISH
 #include "numa.h"
+#include <sched.h>
+#include <pthread.h>
 #endif
 
 #ifdef BARRELFISH
@@ -46,6 +48,7 @@ Configuration::Configuration(void) {
     use_distribution = shl__get_global_conf("global", "distribution", SHL_DISTRIBUTION);
     use_partition = shl__get_global_conf("global", "partitioning", SHL_PARTITION);
     numa_trim = shl__get_global_conf("global", "trim", SHL_NUMA_TRIM);
+    num_replicas = 0;
     stride = shl__get_global_conf("global", "stride", SHL_DISTRIBUTION_STRIDE);
 
     int dma_enable = shl__get_global_conf("dma", "enable", 0);
@@ -78,9 +81,41 @@ Configuration::Configuration(void) {
     use_distribution = shl__get_global_conf("global", "distribution", get_env_int("SHL_DISTRIBUTION", 1));
     use_partition = shl__get_global_conf("global", "partitioning", get_env_int("SHL_PARTITION", 1));
     numa_trim = shl__get_global_conf("global", "trim", get_env_int("SHL_NUMA_TRIM", 1));
+    num_replicas = shl__get_global_conf("global", "replicas", get_env_int("SHL_REPLICAS", 0));
     stride = shl__get_global_conf("global", "stride", PAGESIZE);
     memset(&memcpy_setup, 0, sizeof(struct shl__memcpy_setup));
+
+    // Software DMA: count is the number of copy threads per node
+    int dma_enable = shl__get_global_conf("dma", "enable", get_env_int("SHL_DMA", 0));
+    if (dma_enable) {
+        memcpy_setup.count = shl__get_global_conf("dma", "threads", SHL_DMA_THREADS);
+    }
+#endif
+
+    chunk = shl__get_global_conf("global", "chunk", SHL_PARTITION_CHUNK);
+#ifdef BARRELFISH
+    use_dirty_tracking = false;
+#else
+    use_dirty_tracking = shl__get_global_conf("global", "dirty", get_env_int("SHL_DIRTY", 0));
+#endif
+    use_admission = shl__get_global_conf("global", "admission",
+                                         get_env_int("SHL_ADMISSION", 1));
+#ifdef BARRELFISH
+    use_dynamic_lookup = false;
+    auto_tune = 0;
+#else
+    use_dynamic_lookup = shl__get_global_conf("global", "dynamic_lookup",
+                                              get_env_int("SHL_DYNAMIC_LOOKUP", 0));
+    auto_tune = shl__get_global_conf("global", "autotune",
+                                     get_env_int("SHL_AUTOTUNE", 0));
 #endif
+    auto_tune_barriers = shl__get_global_conf("global", "barriers",
+                                              get_env_int("SHL_BARRIERS", 1));
+    auto_tune_fill = shl__get_global_conf("global", "autotune_fill",
+                                          get_env_int("SHL_AUTOTUNE_FILL", -1));
+    pool_size = (size_t) shl__get_global_conf("global", "pool",
+                                              get_env_int("SHL_POOL", SHL_POOL_SIZE))
+        * 1024 * 1024;
 
     do_crc = shl__get_global_conf("global", "crc", 1);
     printf("do_crc = %d\n", do_crc);
@@ -89,9 +124,13 @@ Configuration::Configuration(void) {
     num_nodes = shl__max_node() + 1;
     printf("Number of nodes is: %d\n", num_nodes);
     num_nodes_active = 0;
+    num_threads = 0;
+    max_threads = 0;
     node_mem_avail = (long*) malloc(sizeof(long)*num_nodes);
     assert (node_mem_avail);
-    assert (num_nodes>0 && num_nodes<100); // Sanity check
+    node_mem_committed = (long*) calloc(num_nodes + 1, sizeof(long));
+    assert (node_mem_committed);
+    assert (num_nodes>0); // Sanity check
     mem_avail = 0;
     use_dma = 0;
     for (int i=0; i<=shl__max_node(); i++) {
@@ -101,206 +140,1398 @@ Configuration::Configuration(void) {
 
 }
 
-static MultiTimer CTimer(1);
-
-void shl__start(void)
+static MultiTimer CTimer(1);
+
+void shl__start(void)
+{
+    CTimer.reset(1);
+    CTimer.start();
+#ifdef PAPI
+    papi_start();
+#endif
+}
+
+void shl__thread_init(void)
+{
+#ifdef PAPI
+    if (PAPI_thread_init(pthread_self) != PAPI_OK)
+        exit(1);
+#endif
+}
+
+void shl__end(void)
+{
+#ifdef PAPI
+    papi_stop();
+#endif
+    CTimer.stop("SOAL_Computation");
+    CTimer.print();
+
+    shl__lua_deinit();
+#ifdef DEBUG
+    printf("Number of lookups: %ld\n", num_lookup);
+#endif
+}
+
+#ifdef PAPI
+#define PAPI_EVENTS_MAX 16
+static bool shl__papi_running = 0;
+static bool shl__papi_init_done = 0;
+void papi_stop(void)
+{
+    if (!shl__papi_running)
+        return;
+
+    // Stop PAPI events
+    long long values[PAPI_EVENTS_MAX];
+    int events[PAPI_EVENTS_MAX];
+
+    printf("Stopping PAPI .. \n");
+
+    // Read performance counters
+    if (PAPI_stop(EventSet, values) != PAPI_OK) handle_error(1);
+
+    // Read event IDs
+    int num_events = PAPI_EVENTS_MAX;
+    if (PAPI_list_events(EventSet, events, &num_events) != PAPI_OK) handle_error(1);
+
+    for (int i=0; i<num_events; i++) {
+
+        char event_name[PAPI_MAX_STR_LEN];
+        if (PAPI_event_code_to_name(events[i], event_name) != PAPI_OK) handle_error(1);
+
+        char number_buf[1024];
+        convert_number(values[i], number_buf);
+
+        printf(ANSI_COLOR_BLUE "PAPI: " ANSI_COLOR_RESET "%20s %15lld %15s\n",
+               event_name, values[i], number_buf);
+    }
+}
+
+void papi_init(void)
+{
+    if (shl__papi_init_done)
+        return;
+    shl__papi_init_done = 1;
+    printf("Initializing PAPI .. ");
+
+    // Initialize PAPI and make sure version matches
+    int retval = PAPI_library_init(PAPI_VER_CURRENT);
+    if (retval != PAPI_VER_CURRENT && retval > 0) { fprintf(stderr,"PAPI library version mismatch!\n"); exit(1); }
+
+    // More checks that PAPI is running?
+    if (retval < 0) handle_error(retval);
+    retval = PAPI_is_initialized();
+    if (retval != PAPI_LOW_LEVEL_INITED) handle_error(retval);
+
+    if (PAPI_thread_init(pthread_self) != PAPI_OK)
+        exit(1);
+
+    printf("DONE\n");
+}
+
+void papi_start(void)
+{
+    printf("Starting PAPI .. \n");
+
+    // Create event set
+    EventSet = PAPI_NULL;
+    if (PAPI_create_eventset(&EventSet) != PAPI_OK) handle_error(1);
+
+    // Read PAPI event from the environment variable
+    char* papi_events =  get_env_str("SHL_PAPI", "");
+    char seps[] = ",";
+
+    char input[PAPI_EVENTS_MAX][PAPI_MAX_STR_LEN];
+    char* token;
+    int i = 0;
+
+    token = strtok (papi_events, seps);
+    while (token != NULL) {
+        sscanf (token, "%s", input[i++]);
+        token = strtok (NULL, seps);
+    }
+
+    // Add PAPI events
+    for (int j=0; j<i; j++) {
+
+        printf("PAPI: monitoring event [%s] .. ", input[j]);
+
+        // Translate ..
+        int event_code;
+        if (PAPI_event_name_to_code(input[j], &event_code) != PAPI_OK) handle_error(1);
+        printf(" %d\n", event_code);
+
+        // Add events to be monitored
+        if (PAPI_add_event(EventSet, event_code) != PAPI_OK) handle_error(1);
+    }
+
+    if (i>0) {
+        // Start monitoring
+        if (PAPI_start(EventSet) != PAPI_OK) handle_error(1);
+        printf("DONE\n");
+
+        shl__papi_running = 1;
+    } else {
+
+        printf(ANSI_COLOR_BLUE "PAPI: " ANSI_COLOR_RESET "no events given, will not activate\n");
+    }
+}
+#endif
+
+/*
+ * -------------------------------------------------------------------------------
+ * Thread registry
+ *
+ * Threads of OpenMP teams are identified by their OpenMP thread
+ * number. Other threads (e.g. std::thread or pthread pools) register,
+ * either explicitly with shl__register_thread, or implicitly on their
+ * first call to shl__get_tid or shl__get_rep_id. The thread id, CPU,
+ * node and replica of registered threads are kept in thread-local
+ * storage.
+ * -------------------------------------------------------------------------------
+ */
+
+#ifndef BARRELFISH
+
+/**
+ * \brief identity of a registered thread
+ */
+struct shl__thread_info {
+    int tid;            ///< thread id, index into replica_lookup
+    int core;           ///< CPU the thread was running on when registering
+    int node;           ///< node of that CPU
+    int rep;            ///< replica used by the thread
+    bool registered;
+};
+
+static __thread struct shl__thread_info thread_self;
+static uint8_t *thread_slot_used;   ///< ids given out implicitly
+static pthread_t thread_initial;    ///< thread calling shl__init
+
+static int *cpu_node = NULL;        ///< node of every CPU
+static int cpu_node_num = 0;
+static bool lookup_dynamic = false; ///< copy of conf->use_dynamic_lookup
+
+/**
+ * \brief Copy the CPU to node table used by the dynamic lookup
+ *
+ * The copy can be read inline, unlike the topology.
+ */
+static void shl__cpu_node_init(void)
+{
+    if (cpu_node != NULL) {
+        return;
+    }
+
+    int num = shl__topo_num_cpus();
+    int *table = (int*) malloc(sizeof(int) * num);
+    assert (table);
+
+    for (int cpu=0; cpu<num; cpu++) {
+        table[cpu] = shl__topo_cpu_node(cpu);
+    }
+
+    cpu_node_num = num;
+    cpu_node = table;
+}
+
+/**
+ * \brief Return the replica of the CPU the calling thread runs on
+ *
+ * sched_getcpu reads the CPU from the restartable sequence area glibc
+ * registers (2.35 and later), or calls getcpu in the vDSO. Either is
+ * much cheaper than a system call, but still more expensive than
+ * reading replica_lookup: callers should look up once per batch of
+ * accesses (see shl_rep_thread_ptr::revalidate). The result may be
+ * stale as soon as it is returned, which only affects locality.
+ */
+int shl__get_cur_rep_id(void)
+{
+    int cpu = sched_getcpu();
+    int node = cpu >= 0 && cpu < cpu_node_num ? cpu_node[cpu] : 0;
+
+    return shl__rep_of_node(node);
+}
+
+/**
+ * \brief Return whether the calling thread is identified by OpenMP
+ */
+static inline bool shl__thread_is_omp(void)
+{
+    return omp_in_parallel() || pthread_equal(pthread_self(), thread_initial);
+}
+
+/**
+ * \brief Register the calling thread
+ *
+ * The thread should be pinned before registering, as its node is
+ * determined from the CPU it is running on. Registering again updates
+ * the information, e.g. after the thread moved to another CPU.
+ *
+ * Threads that register with a tid below the number of threads given to
+ * shl__init take the place of the OpenMP thread with that number, e.g.
+ * for the placement of partitioned arrays. OpenMP threads should not
+ * register: they are placed as given by the affinity configuration,
+ * and the registration would stick to the pthread in later teams.
+ *
+ * \param tid thread id to use, or -1 to use a free one (at or above the
+ *     number of threads given to shl__init, below shl__max_threads)
+ *
+ * Ids at or above the number of threads given to shl__init belong to one
+ * thread at a time; registering with one that another thread holds is an
+ * error.
+ *
+ * \returns the thread id
+ */
+int shl__register_thread(int tid)
+{
+    int max_threads = shl__max_threads();
+
+    if (tid < 0 && thread_self.registered) {
+        tid = thread_self.tid;
+    }
+
+    bool claimed = false;
+    for (int t=shl__num_threads(); tid < 0 && t<max_threads; t++) {
+        if (__sync_bool_compare_and_swap(thread_slot_used + t, 0, 1)) {
+            tid = t;
+            claimed = true;
+        }
+    }
+
+    if (tid < 0) {
+        printf(ANSI_COLOR_RED "WARNING:" ANSI_COLOR_RESET
+               " all %d thread ids in use\n", max_threads);
+    }
+    assert (tid >= 0 && tid < max_threads);
+
+    // Explicit ids above the OpenMP threads are claimed like implicit ones
+    bool own = thread_self.registered && thread_self.tid == tid;
+    if (tid >= shl__num_threads() && !own && !claimed &&
+        !__sync_bool_compare_and_swap(thread_slot_used + tid, 0, 1)) {
+        printf(ANSI_COLOR_RED "ERROR:" ANSI_COLOR_RESET
+               " thread id %d is in use by another thread\n", tid);
+        fflush(stdout);
+        abort();
+    }
+
+    // Release the id this thread held before
+    if (thread_self.registered && !own &&
+        thread_self.tid >= shl__num_threads()) {
+        thread_slot_used[thread_self.tid] = 0;
+    }
+
+    int core = sched_getcpu();
+    int node = core >= 0 && core < shl__topo_num_cpus() ?
+        shl__topo_cpu_node(core) : 0;
+
+    thread_self.tid = tid;
+    thread_self.core = core;
+    thread_self.node = node;
+    thread_self.rep = shl__rep_of_node(node);
+    thread_self.registered = true;
+
+    replica_lookup[tid] = node;
+    if (tid < shl__num_threads()) {
+        shl__rep_coordinators_update();
+    }
+
+    // Cached replica pointers of this thread may be stale
+    shl__rep_thread_epoch_bump();
+
+    SHL_DEBUG_PRINT("thread %d registered on CPU %d, node %d, replica %d\n",
+                    tid, core, node, thread_self.rep);
+
+    return tid;
+}
+
+/**
+ * \brief Deregister the calling thread
+ *
+ * The thread is identified by OpenMP again afterwards, or registered
+ * again implicitly. Threads that registered implicitly have to
+ * deregister before they exit, so that their id can be reused.
+ */
+void shl__deregister_thread(void)
+{
+    if (!thread_self.registered) {
+        return;
+    }
+
+    thread_self.registered = false;
+    if (thread_self.tid >= shl__num_threads()) {
+        thread_slot_used[thread_self.tid] = 0;
+    }
+    shl__rep_thread_epoch_bump();
+}
+
+int shl__get_rep_id(void)
+{
+    if (lookup_dynamic) {
+        return shl__get_cur_rep_id();
+    }
+
+    if (thread_self.registered) {
+        return thread_self.rep;
+    }
+
+    if (shl__thread_is_omp()) {
+        return shl__lookup_rep_id(omp_get_thread_num());
+    }
+
+    shl__register_thread(-1);
+    return thread_self.rep;
+}
+
+#else
+
+int shl__register_thread(int tid)
+{
+    return tid < 0 ? 0 : tid;
+}
+
+int shl__get_cur_rep_id(void)
+{
+    return shl__get_rep_id();
+}
+
+void shl__deregister_thread(void)
+{
+}
+
+#endif /* BARRELFISH */
+
+/**
+ * \brief Lookup replica to be used by given _virtual_ core.
+ *
+ * Virtual cores are always contiguous (0..num_threads-1)
+ */
+int shl__lookup_rep_id(int core)
+{
+#ifdef DEBUG
+    __sync_fetch_and_add(&num_lookup, 1);
+#endif
+    assert(core<shl__max_threads());
+    assert(replica_lookup[core]>=0);
+
+    return shl__rep_of_node(replica_lookup[core]);
+}
+
+/**
+ * \brief Return the thread executing the given loop iteration
+ *
+ * This mirrors the OpenMP static schedule: with a chunk size, chunks
+ * are handed out round-robin; without, every thread gets one
+ * contiguous block, the first (elements % num_threads) threads one
+ * element more than the others.
+ */
+size_t shl__static_schedule_owner(size_t i, size_t elements,
+                                  size_t chunk, size_t num_threads)
+{
+    if (chunk) {
+        return (i / chunk) % num_threads;
+    }
+
+    size_t q = elements / num_threads;
+    size_t r = elements % num_threads;
+
+    if (i < r*(q+1)) {
+        return i / (q+1);
+    }
+
+    return r + (i - r*(q+1)) / q;
+}
+
+/**
+ * \brief Invalidate replica pointers cached by threads
+ *
+ * Has to be called whenever the replica used by a thread changes, e.g.
+ * when threads are mapped to nodes differently. Threads re-resolve
+ * their pointers on their next access (see shl_rep_thread_ptr).
+ */
+void shl__rep_epoch_bump(void)
+{
+    __sync_fetch_and_add(&replica_epoch, 1);
+}
+
+/**
+ * \brief Invalidate replica pointers cached by the calling thread only
+ *
+ * For changes that only affect the calling thread. Unlike
+ * shl__rep_epoch_bump, this does not write shared state.
+ */
+void shl__rep_thread_epoch_bump(void)
+{
+#ifndef BARRELFISH
+    replica_thread_epoch++;
+#else
+    shl__rep_epoch_bump();
+#endif
+}
+
+/*
+ * -------------------------------------------------------------------------------
+ * Replica placement
+ *
+ * With fewer replicas than nodes (global.replicas, or nodes/trim),
+ * replicas are placed on the nodes minimizing the largest distance
+ * from any node with usable CPUs to its nearest replica, and every
+ * node reads from its nearest replica.
+ * -------------------------------------------------------------------------------
+ */
+
+#ifndef BARRELFISH
+static int *rep_node_map = NULL;    ///< node of every replica
+static int *node_rep_map = NULL;    ///< replica read by every node
+static int rep_map_num = 0;         ///< number of replicas
+static int rep_map_nodes = 0;       ///< number of nodes
+
+/**
+ * \brief cost of placing replicas on the given nodes
+ *
+ * \param max returns the largest distance of a reader to its replica
+ * \param sum returns the sum of these distances
+ */
+static void shl__rep_map_cost(const int *reps, int num_reps, const bool *reader,
+                              int num_nodes, int *max, int *sum)
+{
+    *max = 0;
+    *sum = 0;
+
+    for (int n=0; n<num_nodes; n++) {
+
+        if (!reader[n]) {
+            continue;
+        }
+
+        int best = INT_MAX;
+        for (int r=0; r<num_reps; r++) {
+            best = std::min(best, shl__node_distance(n, reps[r]));
+        }
+
+        *max = std::max(*max, best);
+        *sum += best;
+    }
+}
+
+static bool shl__rep_map_better(int max, int sum, int best_max, int best_sum)
+{
+    return max < best_max || (max == best_max && sum < best_sum);
+}
+
+/**
+ * \brief choose the nodes of num_reps replicas
+ *
+ * All combinations are tried if there are few enough, as is the case
+ * for up to 16 nodes, otherwise replicas are added greedily.
+ */
+static void shl__rep_map_place(int *reps, int num_reps, const bool *reader,
+                               int num_nodes)
+{
+    double combinations = 1;
+    for (int i=0; i<num_reps; i++) {
+        combinations = combinations * (num_nodes - i) / (i + 1);
+    }
+
+    int best_max = INT_MAX, best_sum = INT_MAX;
+    int *cur = (int*) malloc(sizeof(int) * num_reps);
+    assert (cur);
+
+    if (combinations <= 100000) {
+
+        for (int i=0; i<num_reps; i++) {
+            cur[i] = i;
+        }
+
+        while (true) {
+            int max, sum;
+            shl__rep_map_cost(cur, num_reps, reader, num_nodes, &max, &sum);
+            if (shl__rep_map_better(max, sum, best_max, best_sum)) {
+                best_max = max;
+                best_sum = sum;
+                memcpy(reps, cur, sizeof(int) * num_reps);
+            }
+
+            // Next combination in lexicographic order
+            int i = num_reps - 1;
+            while (i >= 0 && cur[i] == num_nodes - num_reps + i) {
+                i--;
+            }
+            if (i < 0) {
+                break;
+            }
+            cur[i]++;
+            for (int j=i+1; j<num_reps; j++) {
+                cur[j] = cur[j-1] + 1;
+            }
+        }
+
+    } else {
+
+        for (int r=0; r<num_reps; r++) {
+
+            best_max = INT_MAX;
+            best_sum = INT_MAX;
+            memcpy(cur, reps, sizeof(int) * r);
+
+            for (int n=0; n<num_nodes; n++) {
+
+                if (std::find(reps, reps + r, n) != reps + r) {
+                    continue;
+                }
+
+                int max, sum;
+                cur[r] = n;
+                shl__rep_map_cost(cur, r+1, reader, num_nodes, &max, &sum);
+                if (shl__rep_map_better(max, sum, best_max, best_sum)) {
+                    best_max = max;
+                    best_sum = sum;
+                    reps[r] = n;
+                }
+            }
+        }
+    }
+
+    free(cur);
+
+    std::sort(reps, reps + num_reps);
+}
+
+/**
+ * \brief Build the mapping between replicas and nodes
+ *
+ * Called by shl__init once the topology is known.
+ */
+static void shl__rep_map_init(void)
+{
+    Configuration *conf = get_conf();
+
+    int num_nodes = shl__max_node() + 1;
+    int num_reps = conf->num_replicas;
+    if (num_reps <= 0) {
+        int trim = conf->numa_trim > 0 ? conf->numa_trim : 1;
+        num_reps = (num_nodes + trim - 1) / trim;
+    }
+    num_reps = std::max(1, std::min(num_reps, num_nodes));
+
+    // Only nodes threads can run on read from replicas
+    bool *reader = (bool*) malloc(sizeof(bool) * num_nodes);
+    assert (reader);
+    bool any = false;
+    for (int n=0; n<num_nodes; n++) {
+        reader[n] = shl__topo_node_cpus(n, NULL) > 0;
+        any = any || reader[n];
+    }
+    for (int n=0; n<num_nodes && !any; n++) {
+        reader[n] = true;
+    }
+
+    int *reps = (int*) malloc(sizeof(int) * num_reps);
+    int *node_rep = (int*) malloc(sizeof(int) * num_nodes);
+    assert (reps && node_rep);
+
+    if (num_reps == num_nodes) {
+        for (int r=0; r<num_reps; r++) {
+            reps[r] = r;
+        }
+    } else {
+        shl__rep_map_place(reps, num_reps, reader, num_nodes);
+    }
+
+    for (int n=0; n<num_nodes; n++) {
+        int best = INT_MAX;
+        for (int r=0; r<num_reps; r++) {
+            int d = shl__node_distance(n, reps[r]);
+            if (d < best) {
+                best = d;
+                node_rep[n] = r;
+            }
+        }
+    }
+
+    free(reader);
+
+    // Tables of a previous call are leaked, threads may still read them
+    rep_node_map = reps;
+    node_rep_map = node_rep;
+    rep_map_nodes = num_nodes;
+    rep_map_num = num_reps;
+
+    for (int r=0; r<num_reps && num_reps < num_nodes; r++) {
+        printf("replication: replica %d on node %d serves nodes", r, reps[r]);
+        for (int n=0; n<num_nodes; n++) {
+            if (node_rep[n] == r) {
+                printf(" %d", n);
+            }
+        }
+        printf("\n");
+    }
+}
+#endif
+
+/**
+ * \brief Return the replica read by threads on the given node
+ */
+int shl__rep_of_node(int node)
+{
+#ifdef BARRELFISH
+    int trim = get_conf()->numa_trim;
+
+    return trim ? node/trim : node;
+#else
+    return node >= 0 && node < rep_map_nodes ? node_rep_map[node] : 0;
+#endif
+}
+
+int shl__get_num_replicas(void)
+{
+#ifdef BARRELFISH
+    return get_conf()->num_nodes_active;
+#else
+    return rep_map_num;
+#endif
+}
+
+/**
+ * \brief Return the node holding the given replica
+ *
+ * Callers asking for more replicas than there are get the replica
+ * number as node, as if there were one replica per node.
+ */
+int shl__get_rep_node(int rep)
+{
+#ifdef BARRELFISH
+    return rep;
+#else
+    return rep >= 0 && rep < rep_map_num ? rep_node_map[rep] : rep;
+#endif
+}
+
+/*
+ * -------------------------------------------------------------------------------
+ * Replication domains
+ *
+ * By default, arrays have a replica per node (or group of nodes, see
+ * above). A domain groups CPUs differently, e.g. by last-level cache,
+ * so that small and hot read-only arrays can have a replica per
+ * chiplet. Sub-NUMA clusters are NUMA nodes on Linux already. The
+ * NULL domain is the default one.
+ * -------------------------------------------------------------------------------
+ */
+
+struct shl_rep_domain {
+    int num;            ///< number of replicas
+    int *rep_node;      ///< node of every replica
+    int *cpu_rep;       ///< replica read by every CPU
+    int num_cpus;
+};
+
+#ifndef BARRELFISH
+extern coreid_t *affinity_conf;
+
+/**
+ * \brief Return the CPU identifying the calling thread
+ *
+ * The CPU the thread is bound to, or with the dynamic lookup, the one
+ * it currently runs on.
+ */
+static int shl__thread_cpu(void)
+{
+    if (lookup_dynamic) {
+        return sched_getcpu();
+    }
+
+    if (thread_self.registered) {
+        return thread_self.core;
+    }
+
+    if (shl__thread_is_omp()) {
+        return affinity_conf[omp_get_thread_num()];
+    }
+
+    shl__register_thread(-1);
+    return thread_self.core;
+}
+
+/**
+ * \brief Build a domain from a group per CPU
+ *
+ * CPUs of a group share a replica on the node of the group's lowest
+ * CPU. Replicas are numbered in this order. CPUs without a group (-1)
+ * or outside the affinity mask read the nearest replica.
+ *
+ * \param group group of every CPU, below num_cpus
+ *
+ * \returns the domain, or NULL if no usable CPU is in a group
+ */
+static struct shl_rep_domain* shl__rep_domain_build(const int *group, int num_cpus)
+{
+    int n = shl__topo_num_cpus();
+
+    struct shl_rep_domain *d = (struct shl_rep_domain*)
+        calloc(1, sizeof(struct shl_rep_domain));
+    int *rep_of_group = (int*) malloc(sizeof(int) * num_cpus);
+    assert (d && rep_of_group);
+
+    d->num_cpus = n;
+    d->cpu_rep = (int*) malloc(sizeof(int) * n);
+    d->rep_node = (int*) malloc(sizeof(int) * n);
+    assert (d->cpu_rep && d->rep_node);
+
+    for (int g=0; g<num_cpus; g++) {
+        rep_of_group[g] = -1;
+    }
+
+    for (int cpu=0; cpu<n; cpu++) {
+
+        int g = cpu < num_cpus ? group[cpu] : -1;
+        assert (g < num_cpus);
+
+        d->cpu_rep[cpu] = -1;
+        if (g < 0 || !shl__topo_cpu_allowed(cpu)) {
+            continue;
+        }
+
+        if (rep_of_group[g] < 0) {
+            rep_of_group[g] = d->num;
+            d->rep_node[d->num++] = shl__topo_cpu_node(cpu);
+        }
+        d->cpu_rep[cpu] = rep_of_group[g];
+    }
+
+    free(rep_of_group);
+
+    if (d->num == 0) {
+        printf(ANSI_COLOR_YELLOW "WARNING:" ANSI_COLOR_RESET
+               " replication domain without usable CPUs, using nodes\n");
+        shl__rep_domain_free(d);
+        return NULL;
+    }
+
+    for (int cpu=0; cpu<n; cpu++) {
+
+        if (d->cpu_rep[cpu] >= 0) {
+            continue;
+        }
+
+        int best = INT_MAX;
+        for (int r=0; r<d->num; r++) {
+            int dist = shl__node_distance(shl__topo_cpu_node(cpu), d->rep_node[r]);
+            if (dist < best) {
+                best = dist;
+                d->cpu_rep[cpu] = r;
+            }
+        }
+    }
+
+    return d;
+}
+
+/**
+ * \brief Create a domain with a replica per last-level cache
+ *
+ * Only caches shared by CPUs threads are bound to at this time get a
+ * replica. Has to be called after shl__init.
+ */
+struct shl_rep_domain* shl__rep_domain_llc(void)
+{
+    int n = shl__topo_num_cpus();
+    int *group = (int*) malloc(sizeof(int) * n);
+    bool *used = (bool*) calloc(n, sizeof(bool));
+    assert (group && used);
+
+    for (int t=0; t<shl__num_threads(); t++) {
+        int cpu = affinity_conf[t];
+        if (cpu >= 0 && cpu < n) {
+            used[shl__topo_cpu_llc(cpu)] = true;
+        }
+    }
+
+    for (int cpu=0; cpu<n; cpu++) {
+        int llc = shl__topo_cpu_llc(cpu);
+        group[cpu] = used[llc] ? llc : -1;
+    }
+
+    struct shl_rep_domain *d = shl__rep_domain_build(group, n);
+
+    free(group);
+    free(used);
+
+    return d;
+}
+
+/**
+ * \brief Create a domain from custom groups of CPUs
+ *
+ * \param group    group of every CPU (0 .. num_cpus-1), -1 for none
+ * \param num_cpus number of entries of group
+ */
+struct shl_rep_domain* shl__rep_domain_custom(const int *group, int num_cpus)
+{
+    return shl__rep_domain_build(group, num_cpus);
+}
+#else
+struct shl_rep_domain* shl__rep_domain_llc(void)
+{
+    return NULL;
+}
+
+struct shl_rep_domain* shl__rep_domain_custom(const int *group, int num_cpus)
+{
+    return NULL;
+}
+#endif
+
+/**
+ * \brief Free a domain, after all arrays using it
+ */
+void shl__rep_domain_free(struct shl_rep_domain *d)
+{
+    if (d) {
+        free(d->cpu_rep);
+        free(d->rep_node);
+        free(d);
+    }
+}
+
+int shl__rep_domain_num(const struct shl_rep_domain *d)
+{
+    return d ? d->num : shl__get_num_replicas();
+}
+
+/**
+ * \brief Return the node holding a replica of the domain
+ */
+int shl__rep_domain_node(const struct shl_rep_domain *d, int rep)
+{
+    if (d == NULL || rep < 0 || rep >= d->num) {
+        return shl__get_rep_node(rep);
+    }
+    return d->rep_node[rep];
+}
+
+/**
+ * \brief Return the replica of the domain used by the given OpenMP thread
+ */
+int shl__rep_domain_lookup_tid(const struct shl_rep_domain *d, int tid)
+{
+#ifndef BARRELFISH
+    if (d) {
+        int cpu = affinity_conf[tid];
+        return cpu >= 0 && cpu < d->num_cpus ? d->cpu_rep[cpu] : 0;
+    }
+#endif
+    return shl__lookup_rep_id(tid);
+}
+
+/**
+ * \brief Return the replica of the domain used by the calling thread
+ */
+int shl__rep_domain_lookup(const struct shl_rep_domain *d)
+{
+#ifndef BARRELFISH
+    if (d) {
+        int cpu = shl__thread_cpu();
+        return cpu >= 0 && cpu < d->num_cpus ? d->cpu_rep[cpu] : 0;
+    }
+#endif
+    return shl__get_rep_id();
+}
+
+/*
+ * -------------------------------------------------------------------------------
+ * Memory accounting
+ *
+ * Bytes held by arrays are committed to the node they are on, and
+ * compared against the memory that was free on that node when Shoal
+ * was initialized. Memory of unknown placement (SHL_NUMA_IGNORE) can
+ * end up anywhere, and is compared against the total.
+ * -------------------------------------------------------------------------------
+ */
+
+/**
+ * \brief Return the counter of committed bytes for node
+ */
+static long* shl__mem_committed(int node)
+{
+    Configuration *conf = get_conf();
+
+    if (node < 0 || node >= conf->num_nodes) {
+        return conf->node_mem_committed + conf->num_nodes;
+    }
+
+    return conf->node_mem_committed + node;
+}
+
+/**
+ * \brief Return the number of bytes that can still be committed to node
+ */
+size_t shl__mem_free(int node)
+{
+    Configuration *conf = get_conf();
+
+    long avail = 0;
+    long committed = 0;
+
+    if (node < 0 || node >= conf->num_nodes) {
+        avail = conf->mem_avail;
+        for (int i=0; i<=conf->num_nodes; i++) {
+            committed += conf->node_mem_committed[i];
+        }
+    } else {
+        avail = conf->node_mem_avail[node];
+        committed = conf->node_mem_committed[node];
+    }
+
+    return committed < avail ? avail - committed : 0;
+}
+
+/**
+ * \brief Commit bytes to node
+ *
+ * \param force commit even if the node does not have enough memory
+ *
+ * \returns true if the bytes have been committed
+ */
+bool shl__mem_reserve(int node, size_t bytes, bool force)
+{
+    long *committed = shl__mem_committed(node);
+
+    while (true) {
+
+        long old = *committed;
+        if (!force && shl__mem_free(node) < bytes) {
+            return false;
+        }
+
+        if (__sync_bool_compare_and_swap(committed, old, old + (long) bytes)) {
+            return true;
+        }
+    }
+}
+
+/**
+ * \brief Release bytes committed with shl__mem_reserve
+ */
+void shl__mem_release(int node, size_t bytes)
 {
-    CTimer.reset(1);
-    CTimer.start();
-#ifdef PAPI
-    papi_start();
-#endif
+    __sync_fetch_and_sub(shl__mem_committed(node), (long) bytes);
 }
 
-void shl__thread_init(void)
+/**
+ * \brief Return the first replica sharing its memory with replica r
+ *
+ * Replicas that do not fit on their node share the memory of another
+ * one (see shl__malloc_replicated). Only the first of them is written.
+ */
+int shl__repl_canonical(void **replicas, int r)
 {
-#ifdef PAPI
-    if (PAPI_thread_init(pthread_self) != PAPI_OK)
-        exit(1);
-#endif
+    for (int s=0; s<r; s++) {
+        if (replicas[s] == replicas[r])
+            return s;
+    }
+    return r;
 }
 
-void shl__end(void)
+#ifndef BARRELFISH
+/**
+ * \brief Group the threads of a parallel region by the replica they use
+ *
+ * \param rep_of returns the replica of every thread, -1 for threads
+ *     not using any of the replicas
+ * \param rank   returns the index of every thread within its group
+ * \param count  returns the number of threads per replica (zeroed)
+ */
+static void shl__repl_groups(void **replicas, int num_replicas,
+                             const struct shl_rep_domain *domain, int nt,
+                             int *rep_of, int *rank, int *count)
 {
-#ifdef PAPI
-    papi_stop();
-#endif
-    CTimer.stop("SOAL_Computation");
-    CTimer.print();
+    for (int r=0; r<num_replicas; r++)
+        count[r] = 0;
 
-    shl__lua_deinit();
-#ifdef DEBUG
-    printf("Number of lookups: %ld\n", num_lookup);
-#endif
+    for (int t=0; t<nt; t++) {
+        int r = t<shl__num_threads() ? shl__rep_domain_lookup_tid(domain, t) : -1;
+        rep_of[t] = (r>=0 && r<num_replicas) ? shl__repl_canonical(replicas, r) : -1;
+        rank[t] = rep_of[t]<0 ? 0 : count[rep_of[t]]++;
+    }
 }
+#endif
 
-#ifdef PAPI
-#define PAPI_EVENTS_MAX 16
-static bool shl__papi_running = 0;
-static bool shl__papi_init_done = 0;
-void papi_stop(void)
+/**
+ * \brief Fill all replicas of an array in parallel, node-locally
+ *
+ * Every replica is written only by the threads that use it (i.e. that
+ * run on the replica's node): each of them calls fn on its share of
+ * the range [offset, offset+size) of its replica. All replicas are
+ * filled concurrently.
+ *
+ * Replicas no thread runs close to are copied afterwards from the
+ * nearest replica that has been filled, by all threads.
+ *
+ * \param replicas     the replicas
+ * \param num_replicas number of replicas
+ * \param offset       first byte of the range to fill
+ * \param size         size of the range in bytes
+ * \param element_size shares are multiples of this many bytes
+ * \param fn           fills the given part of one replica
+ * \param arg          passed on to fn
+ * \param domain       replication domain of the replicas, NULL for nodes
+ */
+void shl__repl_fill(void **replicas, int num_replicas, size_t offset,
+                    size_t size, size_t element_size,
+                    shl__fill_fn_t fn, void *arg,
+                    const struct shl_rep_domain *domain)
 {
-    if (!shl__papi_running)
+    if (size == 0 || num_replicas <= 0) {
         return;
+    }
 
-    // Stop PAPI events
-    long long values[PAPI_EVENTS_MAX];
-    int events[PAPI_EVENTS_MAX];
+#ifndef BARRELFISH
+    int max_threads = omp_get_max_threads();
+    int *rep_of = (int*) malloc(max_threads * sizeof(int));
+    int *rank = (int*) malloc(max_threads * sizeof(int));
+    int *count = (int*) calloc(num_replicas, sizeof(int));
+    int *source = (int*) malloc(num_replicas * sizeof(int));
+    assert (rep_of && rank && count && source);
+
+    size_t elements = size / element_size;
+
+#pragma omp parallel
+    {
+        int tid = omp_get_thread_num();
+        int nt = omp_get_num_threads();
+
+#pragma omp single
+        {
+            shl__repl_groups(replicas, num_replicas, domain, nt, rep_of, rank, count);
+
+            // Nobody runs close to any replica: fill the first one
+            // with all threads
+            bool any = false;
+            for (int r=0; r<num_replicas; r++)
+                any |= count[r]>0;
+
+            if (!any) {
+                for (int t=0; t<nt; t++) {
+                    rep_of[t] = 0;
+                    rank[t] = count[0]++;
+                }
+            }
+
+            // Pick the nearest filled replica for the remaining ones
+            for (int r=0; r<num_replicas; r++) {
+
+                source[r] = -1;
+                if (count[r]>0 || shl__repl_canonical(replicas, r) != r)
+                    continue;
+
+                int best = INT_MAX;
+                for (int s=0; s<num_replicas; s++) {
+
+                    if (count[s]==0)
+                        continue;
+
+                    int d = shl__node_distance(shl__rep_domain_node(domain, r),
+                                               shl__rep_domain_node(domain, s));
+                    if (d < best) {
+                        best = d;
+                        source[r] = s;
+                    }
+                }
+            }
+        }
 
-    printf("Stopping PAPI .. \n");
+        // Fill own replica
+        int r = rep_of[tid];
+        if (r>=0) {
 
-    // Read performance counters
-    if (PAPI_stop(EventSet, values) != PAPI_OK) handle_error(1);
+            size_t first = elements * rank[tid] / count[r];
+            size_t last = elements * (rank[tid]+1) / count[r];
+            size_t len = (last-first)*element_size;
+            if (rank[tid]+1 == count[r])
+                len = size - first*element_size;
 
-    // Read event IDs
-    int num_events = PAPI_EVENTS_MAX;
-    if (PAPI_list_events(EventSet, events, &num_events) != PAPI_OK) handle_error(1);
+            size_t off = offset + first*element_size;
+            if (len)
+                fn((char*) replicas[r] + off, off, len, arg);
+        }
 
-    for (int i=0; i<num_events; i++) {
+#pragma omp barrier
 
-        char event_name[PAPI_MAX_STR_LEN];
-        if (PAPI_event_code_to_name(events[i], event_name) != PAPI_OK) handle_error(1);
+        // Copy remaining replicas from their nearest filled one
+        for (int o=0; o<num_replicas; o++) {
 
-        char number_buf[1024];
-        convert_number(values[i], number_buf);
+            if (source[o]<0)
+                continue;
 
-        printf(ANSI_COLOR_BLUE "PAPI: " ANSI_COLOR_RESET "%20s %15lld %15s\n",
-               event_name, values[i], number_buf);
+            size_t first = elements * tid / nt;
+            size_t last = elements * (tid+1) / nt;
+            size_t len = (last-first)*element_size;
+            if (tid+1 == nt)
+                len = size - first*element_size;
+
+            size_t off = offset + first*element_size;
+            if (len)
+                memcpy((char*) replicas[o] + off,
+                       (char*) replicas[source[o]] + off, len);
+        }
     }
+
+    free(rep_of);
+    free(rank);
+    free(count);
+    free(source);
+#else
+    for (int r=0; r<num_replicas; r++) {
+        if (shl__repl_canonical(replicas, r) == r)
+            fn((char*) replicas[r] + offset, offset, size, arg);
+    }
+#endif
 }
 
-void papi_init(void)
+/**
+ * \brief Copy part [first, last) of the concatenation of runs
+ *
+ * \param sum prefix sums of the run sizes (num_runs+1 entries)
+ */
+static void shl__copy_runs(char *dst, const char *src, struct shl__range *runs,
+                           size_t *sum, long num_runs, size_t first,
+                           size_t last, bool stream)
 {
-    if (shl__papi_init_done)
-        return;
-    shl__papi_init_done = 1;
-    printf("Initializing PAPI .. ");
-
-    // Initialize PAPI and make sure version matches
-    int retval = PAPI_library_init(PAPI_VER_CURRENT);
-    if (retval != PAPI_VER_CURRENT && retval > 0) { fprintf(stderr,"PAPI library version mismatch!\n"); exit(1); }
+    long i = std::upper_bound(sum, sum + num_runs + 1, first) - sum - 1;
 
-    // More checks that PAPI is running?
-    if (retval < 0) handle_error(retval);
-    retval = PAPI_is_initialized();
-    if (retval != PAPI_LOW_LEVEL_INITED) handle_error(retval);
+    for (; i<num_runs && sum[i]<last; i++) {
 
-    if (PAPI_thread_init(pthread_self) != PAPI_OK)
-        exit(1);
+        size_t from = std::max(first, sum[i]) - sum[i];
+        size_t to = std::min(last, sum[i+1]) - sum[i];
+        size_t offset = runs[i].offset + from;
 
-    printf("DONE\n");
+        shl__memcpy_simd(dst + offset, src + offset, to - from, stream);
+    }
 }
 
-void papi_start(void)
+/**
+ * \brief Copy the given parts of src to all replicas
+ *
+ * Every replica is written by the threads that use it, each copying
+ * its share of the parts. Replicas no thread runs close to are
+ * written by all threads.
+ */
+static void shl__repl_sync_runs(void *src, void **dest, int num_dest,
+                                const struct shl_rep_domain *domain,
+                                struct shl__range *runs, long num_runs)
 {
-    printf("Starting PAPI .. \n");
+    size_t *sum = (size_t*) malloc((num_runs+1) * sizeof(size_t));
+    assert (sum);
 
-    // Create event set
-    EventSet = PAPI_NULL;
-    if (PAPI_create_eventset(&EventSet) != PAPI_OK) handle_error(1);
+    sum[0] = 0;
+    for (long i=0; i<num_runs; i++) {
+        sum[i+1] = sum[i] + runs[i].size;
+    }
 
-    // Read PAPI event from the environment variable
-    char* papi_events =  get_env_str("SHL_PAPI", "");
-    char seps[] = ",";
+    size_t total = sum[num_runs];
+    if (total == 0) {
+        free(sum);
+        return;
+    }
 
-    char input[PAPI_EVENTS_MAX][PAPI_MAX_STR_LEN];
-    char* token;
-    int i = 0;
+    bool stream = total * num_dest >= SHL_STREAM_THRESHOLD;
 
-    token = strtok (papi_events, seps);
-    while (token != NULL) {
-        sscanf (token, "%s", input[i++]);
-        token = strtok (NULL, seps);
+#ifndef BARRELFISH
+    int max_threads = omp_get_max_threads();
+    int *rep_of = (int*) malloc(max_threads * sizeof(int));
+    int *rank = (int*) malloc(max_threads * sizeof(int));
+    int *count = (int*) malloc(num_dest * sizeof(int));
+    assert (rep_of && rank && count);
+
+#pragma omp parallel
+    {
+        int tid = omp_get_thread_num();
+        int nt = omp_get_num_threads();
+
+#pragma omp single
+        shl__repl_groups(dest, num_dest, domain, nt, rep_of, rank, count);
+
+        for (int r=0; r<num_dest; r++) {
+
+            if (shl__repl_canonical(dest, r) != r)
+                continue;
+
+            int k, c;
+            if (count[r]>0) {
+                if (rep_of[tid] != r)
+                    continue;
+                k = rank[tid];
+                c = count[r];
+            } else {
+                k = tid;
+                c = nt;
+            }
+
+            shl__copy_runs((char*) dest[r], (char*) src, runs, sum, num_runs,
+                           total * k / c, total * (k+1) / c, stream);
+        }
     }
 
-    // Add PAPI events
-    for (int j=0; j<i; j++) {
+    free(rep_of);
+    free(rank);
+    free(count);
+#else
+    for (int r=0; r<num_dest; r++) {
+        if (shl__repl_canonical(dest, r) == r)
+            shl__copy_runs((char*) dest[r], (char*) src, runs, sum, num_runs,
+                           0, total, stream);
+    }
+#endif
 
-        printf("PAPI: monitoring event [%s] .. ", input[j]);
+    free(sum);
+}
 
-        // Translate ..
-        int event_code;
-        if (PAPI_event_name_to_code(input[j], &event_code) != PAPI_OK) handle_error(1);
-        printf(" %d\n", event_code);
+/**
+ * \brief Bring replicas up to date with src
+ *
+ * If src is tracked (dirty is the handle returned by shl__dirty_track
+ * for it), only the parts written since the last synchronization are
+ * copied, otherwise (dirty is NULL) everything. domain is the
+ * replication domain of dest, NULL for nodes.
+ */
+void shl__repl_sync(void* src, struct shl__dirty_region *dirty, void **dest,
+                    size_t num_dest, size_t size,
+                    const struct shl_rep_domain *domain)
+{
+    struct shl__range all = { 0, size };
+    struct shl__range *runs = NULL;
 
-        // Add events to be monitored
-        if (PAPI_add_event(EventSet, event_code) != PAPI_OK) handle_error(1);
+    long num_runs = shl__dirty_collect(dirty, &runs);
+    if (num_runs < 0) {
+        runs = &all;
+        num_runs = 1;
     }
 
-    if (i>0) {
-        // Start monitoring
-        if (PAPI_start(EventSet) != PAPI_OK) handle_error(1);
-        printf("DONE\n");
+    shl__repl_sync_runs(src, dest, num_dest, domain, runs, num_runs);
 
-        shl__papi_running = 1;
-    } else {
-
-        printf(ANSI_COLOR_BLUE "PAPI: " ANSI_COLOR_RESET "no events given, will not activate\n");
+    if (runs != &all) {
+        free(runs);
     }
 }
-#endif
-
-#ifndef BARRELFISH
-int shl__get_rep_id(void)
-{
-#ifdef BARRELFISH
-    return shl__lookup_rep_id(omp_get_thread_num());
-#else
-    return shl__lookup_rep_id(omp_get_thread_num());
-#endif
-}
-#endif
 
 /**
- * \brief Lookup replica to be used by given _virtual_ core.
+ * \brief Copy part [first, last) of the runs not owned by replica r
  *
- * Virtual cores are always contiguous (0..num_threads-1)
+ * Positions count the bytes of those runs only.
  */
-int shl__lookup_rep_id(int core)
+static void shl__exchange_runs(void **replicas, int r,
+                               struct shl__range *runs, const int *owner,
+                               long num_runs, size_t first, size_t last,
+                               bool stream)
 {
-#ifdef DEBUG
-    __sync_fetch_and_add(&num_lookup, 1);
-#endif
-#ifndef BARRELFISH
-    assert(omp_get_num_threads()<MAXCORES);
-#endif
-    assert(core<MAXCORES);
-    assert(replica_lookup[core]>=0);
+    size_t pos = 0;
 
-    int repid = replica_lookup[core];
+    for (long i=0; i<num_runs && pos<last; i++) {
 
-    if (get_conf()->numa_trim) {
-        return repid/get_conf()->numa_trim;
-    }
+        int o = shl__repl_canonical(replicas, owner[i]);
+        if (o == r)
+            continue;
 
-    return repid;
+        size_t from = std::max(first, pos) - pos;
+        size_t to = std::min(last, pos + runs[i].size) - pos;
+        if (from < to) {
+            size_t offset = runs[i].offset + from;
+            shl__memcpy_simd((char*) replicas[r] + offset,
+                             (char*) replicas[o] + offset, to - from, stream);
+        }
+
+        pos += runs[i].size;
+    }
 }
 
-int shl__get_num_replicas(void)
+/**
+ * \brief Make the parts of all replicas owned by one replica each
+ * identical
+ *
+ * Part i (runs[i]) is up to date in replica owner[i] only. It is
+ * copied to all other replicas. Every replica is written by the
+ * threads that use it, each copying its share of the parts owned by
+ * other replicas, so that remote memory is only read. Replicas no
+ * thread runs close to are written by all threads.
+ *
+ * \param domain replication domain of the replicas, NULL for nodes
+ */
+void shl__repl_exchange(void **replicas, int num_replicas,
+                        const struct shl_rep_domain *domain,
+                        struct shl__range *runs, const int *owner,
+                        long num_runs)
 {
-#ifdef BARRELFISH
-    return get_conf()->num_nodes_active;
-#else
-    int trim = get_conf()->numa_trim;
-    int num_nodes = shl__max_node()+1;
+    size_t all = 0;
+    for (long i=0; i<num_runs; i++) {
+        all += runs[i].size;
+    }
 
-    assert (num_nodes%2 == 0 || trim == 1);
-    assert (num_nodes>=trim);
+    if (all == 0 || num_replicas < 2) {
+        return;
+    }
 
-    return num_nodes/trim;
-#endif
-}
+    bool stream = all * (num_replicas - 1) >= SHL_STREAM_THRESHOLD;
+
+    // Bytes each replica receives
+    size_t *total = (size_t*) calloc(num_replicas, sizeof(size_t));
+    assert (total);
+    for (int r=0; r<num_replicas; r++) {
+        for (long i=0; i<num_runs; i++) {
+            if (shl__repl_canonical(replicas, owner[i]) != r)
+                total[r] += runs[i].size;
+        }
+    }
 
-void shl__repl_sync(void* src, void **dest, size_t num_dest, size_t size)
-{
-    for (size_t i=0; i<num_dest; i++) {
 #ifndef BARRELFISH
-        #pragma omp parallel for
-#endif
-        for (size_t j=0; j<size; j++) {
-            ((char*) dest[i])[j] = ((char*) src)[j];
+    int max_threads = omp_get_max_threads();
+    int *rep_of = (int*) malloc(max_threads * sizeof(int));
+    int *rank = (int*) malloc(max_threads * sizeof(int));
+    int *count = (int*) malloc(num_replicas * sizeof(int));
+    assert (rep_of && rank && count);
+
+#pragma omp parallel
+    {
+        int tid = omp_get_thread_num();
+        int nt = omp_get_num_threads();
+
+#pragma omp single
+        shl__repl_groups(replicas, num_replicas, domain, nt, rep_of, rank, count);
+
+        for (int r=0; r<num_replicas; r++) {
+
+            if (shl__repl_canonical(replicas, r) != r)
+                continue;
+
+            int k, c;
+            if (count[r]>0) {
+                if (rep_of[tid] != r)
+                    continue;
+                k = rank[tid];
+                c = count[r];
+            } else {
+                k = tid;
+                c = nt;
+            }
+
+            shl__exchange_runs(replicas, r, runs, owner, num_runs,
+                               total[r] * k / c, total[r] * (k+1) / c, stream);
         }
     }
+
+    free(rep_of);
+    free(rank);
+    free(count);
+#else
+    for (int r=0; r<num_replicas; r++) {
+        if (shl__repl_canonical(replicas, r) == r)
+            shl__exchange_runs(replicas, r, runs, owner, num_runs,
+                               0, total[r], stream);
+    }
+#endif
+
+    free(total);
 }
 
 void shl__init_thread(int thread_id)
@@ -322,6 +1553,68 @@ void handle_error(int retval)
 // translate: virtual COREID -> physical COREID
 coreid_t *affinity_conf = NULL;
 
+#ifndef BARRELFISH
+/**
+ * \brief Determine the CPU of every thread
+ *
+ * Taken from SHL_CPU_AFFINITY if given. Otherwise, threads are spread
+ * over the allowed CPUs, or, with global.autotune (SHL_AUTOTUNE=1),
+ * chosen by shl__auto_tune_bind, which may also reduce the number of
+ * threads. Callers sizing data structures by the requested number
+ * have to check shl__num_threads() then.
+ *
+ * \param num_threads requested number of threads, returns the number
+ *     of threads to use
+ */
+static coreid_t* shl__init_affinity(uint32_t *num_threads)
+{
+    Configuration *conf = get_conf();
+    coreid_t *aff = parse_affinity (false);
+
+    if (aff==NULL) {
+
+        aff = (coreid_t*) malloc(sizeof(coreid_t) * *num_threads);
+        assert (aff);
+
+        if (conf->auto_tune) {
+            int num = *num_threads;
+            shl__auto_tune_bind(&num, aff, conf->auto_tune_barriers);
+
+            if ((uint32_t) num < *num_threads) {
+                printf(ANSI_COLOR_YELLOW "WARNING:" ANSI_COLOR_RESET " auto-tuning: "
+                       "using %d instead of %u threads\n", num, *num_threads);
+                *num_threads = num;
+                omp_set_num_threads(num);
+            }
+
+        } else {
+            // Spread threads over the CPUs the process may run on, e.g.
+            // the cpuset of its container
+            const int *cpus;
+            int num_cpus = shl__topo_allowed_cpus(&cpus);
+            assert (num_cpus > 0);
+
+            for (uint32_t i=0; i<*num_threads; i++) {
+                aff[i] = cpus[i % num_cpus];
+            }
+
+            printf(ANSI_COLOR_YELLOW "WARNING:" ANSI_COLOR_RESET " no SHL_CPU_AFFINITY, "
+                   "using the %d CPUs of the affinity mask\n", num_cpus);
+        }
+    }
+
+    for (uint32_t i=0; i<*num_threads; i++) {
+        if (!shl__topo_cpu_allowed(aff[i])) {
+            printf(ANSI_COLOR_RED "WARNING:" ANSI_COLOR_RESET " CPU %" PRIuCOREID
+                   " of thread %u is not in the affinity mask of the process\n",
+                   aff[i], i);
+        }
+    }
+
+    return aff;
+}
+#endif
+
 /**
  * \brief Initialize shoal library
  *
@@ -360,8 +1653,34 @@ size_t shl__init(uint32_t num_threads, bool partitioned_support)
 
     assert (shl__check_numa_availability()>=0);
 
+#ifndef BARRELFISH
+    thread_initial = pthread_self();
+
+    shl__topo_init();
+    shl__cpu_node_init();
+    shl__rep_map_init();
+    lookup_dynamic = conf->use_dynamic_lookup;
+
+    affinity_conf = shl__init_affinity(&num_threads);
+#endif
+
     conf->num_threads = num_threads;
 
+#ifndef BARRELFISH
+    // Room for one thread per CPU next to the OpenMP threads
+    conf->max_threads = num_threads + cpu_node_num;
+
+    free(thread_slot_used);
+    thread_slot_used = (uint8_t*) calloc(conf->max_threads, sizeof(uint8_t));
+    assert (thread_slot_used);
+#else
+    conf->max_threads = num_threads;
+#endif
+
+    free(replica_lookup);
+    replica_lookup = (int*) malloc(conf->max_threads * sizeof(int));
+    assert (replica_lookup);
+
     if (conf->memcpy_setup.count) {
         if (shl__memcpy_init(&conf->memcpy_setup)) {
             printf("DMA Copying: " ANSI_COLOR_RED " Disabled (Error in initializing). "
@@ -397,22 +1716,13 @@ size_t shl__init(uint32_t num_threads, bool partitioned_support)
         }
     }
 
-    affinity_conf = parse_affinity (false);
 #else
     affinity_conf = (coreid_t *)-1;
 #endif
 
-    for (int i=0; i<MAXCORES; i++)
+    for (size_t i=0; i<conf->max_threads; i++)
         replica_lookup[i] = -1;
 
-    if (affinity_conf==NULL) {
-        printf(ANSI_COLOR_RED "WARNING:" ANSI_COLOR_RESET " no affinity set! "
-               "Disabling replication! "
-               "Use SHL_CPU_AFFINITY\n");
-        conf->use_replication = false;
-        assert (!"Do we really want to support runs without affinity?");
-    }
-
 #ifdef BARRELFISH
 #define CPU_AFF_CONF i
 #else
@@ -434,6 +1744,8 @@ size_t shl__init(uint32_t num_threads, bool partitioned_support)
         }
     }
     get_conf()->num_nodes_active = max_node + 1;
+    shl__rep_coordinators_update();
+    shl__rep_epoch_bump();
 
     for (int i=0; i<shl__get_num_replicas(); i++) {
         printf("replica %d - coordinator %d\n", i, shl__rep_coordinator(i));
@@ -447,6 +1759,12 @@ size_t shl__init(uint32_t num_threads, bool partitioned_support)
     printf(ANSI_COLOR_RED "WARNING:" ANSI_COLOR_RESET " debug enabled in #define\n");
 #endif
 
+    if (shl__cacheline_size() > CACHELINE) {
+        printf(ANSI_COLOR_RED "WARNING:" ANSI_COLOR_RESET " cachelines are %d bytes, "
+               "but per-thread state is padded to %d. Compile with -DCACHELINE=%d\n",
+               shl__cacheline_size(), CACHELINE, shl__cacheline_size());
+    }
+
 #ifdef SHL_DEBUG
     printf(ANSI_COLOR_RED "WARNING:" ANSI_COLOR_RESET " debug enabled in Makefile\n");
 #endif
@@ -461,6 +1779,15 @@ size_t shl__init(uint32_t num_threads, bool partitioned_support)
     printf("[%c] Partition\n", conf->use_partition ? 'x' : ' ');
     printf("[%c] Hugepage\n", conf->use_hugepage ? 'x' : ' ');
     printf("[%d] NUMA trim\n", conf->numa_trim);
+    printf("[%d] Replicas\n", shl__get_num_replicas());
+    printf("[%zu] Partition chunk\n", conf->chunk);
+    printf("[%c] Dirty tracking\n", conf->use_dirty_tracking ? 'x' : ' ');
+    printf("[%zu] Pool size (MB)\n", conf->pool_size / (1024 * 1024));
+    printf("[%c] Admission control\n", conf->use_admission ? 'x' : ' ');
+    printf("[%d] Cacheline (bytes)\n", CACHELINE);
+    printf("[%c] Dynamic replica lookup\n", conf->use_dynamic_lookup ? 'x' : ' ');
+    printf("[%d] Auto-tuning\n", conf->auto_tune);
+    printf("[%s] Copy kernels\n", shl__simd_name());
     printf("[%c] DMA enabled\n", conf->use_dma ? 'x' : ' ');
     printf("[%c] CRC check\n", conf->do_crc ? 'x' : ' ');
 
@@ -472,34 +1799,85 @@ int shl__num_threads(void)
     return get_conf()->num_threads;
 }
 
+/**
+ * \brief Return the number of thread ids
+ *
+ * Thread ids are below this number, which is the size of per-thread
+ * state (see shl_per_thread). It is known after shl__init.
+ */
+int shl__max_threads(void)
+{
+    return get_conf()->max_threads;
+}
+
 int shl__get_tid(void)
 {
 #ifndef BARRELFISH
-    return omp_get_thread_num();
+    if (thread_self.registered) {
+        return thread_self.tid;
+    }
+
+    if (shl__thread_is_omp()) {
+        return omp_get_thread_num();
+    }
+
+    return shl__register_thread(-1);
 #else
     return 0;
 #endif
 }
 
-int shl__rep_coordinator(int rep)
+static int *rep_coordinators = NULL;    ///< lowest thread of every replica
+static int rep_coordinators_num = 0;
+
+/**
+ * \brief Recompute the coordinator of every replica
+ *
+ * Has to be called whenever replica_lookup changes.
+ */
+void shl__rep_coordinators_update(void)
 {
-    int c = INT_MAX;
-    for (int i=0; i<shl__num_threads(); i++) {
+    int num = shl__get_num_replicas();
+
+    if (rep_coordinators_num < num) {
+        // The old table is leaked, threads may still read it
+        int *table = (int*) malloc(sizeof(int) * num);
+        assert (table);
+        for (int j=0; j<num; j++) {
+            table[j] = INT_MAX;
+        }
+        rep_coordinators = table;
+        rep_coordinators_num = num;
+    }
+
+    for (int j=0; j<num; j++) {
+
+        int c = INT_MAX;
+        for (int i=0; i<shl__num_threads(); i++) {
+
+            if (replica_lookup[i] >= 0 && shl__lookup_rep_id(i)==j)
+                c = std::min(c, i);
+        }
 
-        if (shl__lookup_rep_id(i)==rep)
-            c = std::min(c, i);
+        rep_coordinators[j] = c;
     }
+}
 
-    return c;
+/**
+ * \brief Return the lowest thread using the given replica, INT_MAX if
+ * there is none
+ */
+int shl__rep_coordinator(int rep)
+{
+    assert (rep >= 0 && rep < rep_coordinators_num);
+    return rep_coordinators[rep];
 }
 
 bool shl__is_rep_coordinator(int tid)
 {
-    for (int j=0; j<shl__get_num_replicas(); j++) {
-
-        if( shl__rep_coordinator(j)==tid)
-            return true;
+    if (tid < 0 || tid >= shl__num_threads() || replica_lookup[tid] < 0) {
+        return false;
     }
 
-    return false;
+    return shl__rep_coordinator(shl__lookup_rep_id(tid)) == tid;
 }
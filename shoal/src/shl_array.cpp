@@ -60,6 +60,131 @@ int shl__estimate_working_set_size(int num, ...)
 }
 
 
+static const char *shl__array_type_name(array_t type)
+{
+    switch (type) {
+    case SHL_A_SINGLE_NODE: return "single-node";
+    case SHL_A_DISTRIBUTED: return "distributed";
+    case SHL_A_PARTITIONED: return "partitioned";
+    case SHL_A_REPLICATED:  return "replicated";
+    default:                return "other";
+    }
+}
+
+/**
+ * \brief Check whether every node with threads can hold its share of
+ * an array spread over all of them
+ */
+static bool shl__admit_spread(size_t size)
+{
+    int num_nodes = get_conf()->num_nodes;
+    bool *active = (bool*) calloc(num_nodes, sizeof(bool));
+    assert (active);
+
+    int num_active = 0;
+    for (int t=0; t<shl__num_threads(); t++) {
+        int node = replica_lookup[t];
+        if (node >= 0 && node < num_nodes && !active[node]) {
+            active[node] = true;
+            num_active++;
+        }
+    }
+
+    bool fits = num_active > 0;
+    for (int node=0; node<num_nodes && fits; node++) {
+        if (active[node] && shl__mem_free(node) < size / num_active) {
+            fits = false;
+        }
+    }
+
+    free(active);
+
+    return fits;
+}
+
+/**
+ * \brief Admission control: choose a placement the nodes can hold
+ *
+ * Compares the memory an array of the given type needs on every node
+ * against the memory not yet committed to arrays (see
+ * shl__mem_reserve). Placements that do not fit are downgraded:
+ *
+ * replicated -> partially replicated -> distributed -> single-node
+ * partitioned/distributed -> single-node
+ *
+ * A partially replicated array is still a replicated array; the
+ * replicas that do not fit share the nearest one that does (see
+ * shl__malloc_replicated). Single-node is always admitted: the kernel
+ * places its pages wherever memory is left, which is slower than
+ * failing, but does not terminate the program.
+ *
+ * Every decision is logged.
+ *
+ * \param size size of the array in bytes
+ * \param type the preferred placement
+ *
+ * \returns the admitted placement
+ */
+array_t shl__admit_array(const char *name, size_t size, array_t type)
+{
+    array_t res = type;
+
+    if (!get_conf()->use_admission) {
+        return type;
+    }
+
+    if (type == SHL_A_REPLICATED) {
+
+        int num_replicas = shl__get_num_replicas();
+        int fits = 0;
+        for (int r=0; r<num_replicas; r++) {
+            if (shl__mem_free(shl__get_rep_node(r)) >= size)
+                fits++;
+        }
+
+        if (fits == num_replicas) {
+            printf("admission: array [%-30s] %zu bytes: replicated on %d nodes\n",
+                   name, size, num_replicas);
+            return res;
+        }
+
+        if (fits >= 2) {
+            printf(ANSI_COLOR_YELLOW "WARNING:" ANSI_COLOR_RESET
+                   " admission: array [%-30s] %zu bytes: partially replicated"
+                   " on %d of %d nodes\n", name, size, fits, num_replicas);
+            return res;
+        }
+
+        res = get_conf()->use_distribution && num_replicas > 1 ?
+            SHL_A_DISTRIBUTED : SHL_A_SINGLE_NODE;
+    }
+
+    if (res == SHL_A_DISTRIBUTED || res == SHL_A_PARTITIONED) {
+
+        if (!shl__admit_spread(size)) {
+            res = SHL_A_SINGLE_NODE;
+        } else if (res != type) {
+            printf(ANSI_COLOR_YELLOW "WARNING:" ANSI_COLOR_RESET
+                   " admission: array [%-30s] %zu bytes: %s instead of %s\n",
+                   name, size, shl__array_type_name(res),
+                   shl__array_type_name(type));
+            return res;
+        }
+    }
+
+    if (res != type) {
+        printf(ANSI_COLOR_YELLOW "WARNING:" ANSI_COLOR_RESET
+               " admission: array [%-30s] %zu bytes: %s instead of %s"
+               " (%zu bytes free)\n", name, size, shl__array_type_name(res),
+               shl__array_type_name(type), shl__mem_free(SHL_NUMA_IGNORE));
+    } else {
+        printf("admission: array [%-30s] %zu bytes: %s\n",
+               name, size, shl__array_type_name(res));
+    }
+
+    return res;
+}
+
 unsigned long shl__calculate_crc(void *array, size_t elements, size_t element_size)
 {
     crc_t crc = crc_init();
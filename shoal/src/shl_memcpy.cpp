@@ -0,0 +1,392 @@
+/*
+ * Copyright (c) 2014 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+
+#include <omp.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "shl.h"
+
+/*
+ * -------------------------------------------------------------------------------
+ * Kernels
+ *
+ * copy: dst is aligned to SHL_SIMD_ALIGN, src is arbitrary
+ * fill: dst is aligned to SHL_SIMD_ALIGN, pattern holds SHL_SIMD_ALIGN bytes
+ *       to be repeated starting at dst
+ *
+ * size needs not be a multiple of the vector width.
+ * -------------------------------------------------------------------------------
+ */
+
+#define SHL_SIMD_ALIGN 64
+
+typedef void (*shl__copy_kernel_t)(char *dst, const char *src, size_t size);
+typedef void (*shl__fill_kernel_t)(char *dst, const char *pattern, size_t size,
+                                   bool stream);
+
+static void shl__fill_tail(char *dst, const char *pattern, size_t size)
+{
+    memcpy(dst, pattern, size);
+}
+
+static void shl__copy_generic(char *dst, const char *src, size_t size)
+{
+    memcpy(dst, src, size);
+}
+
+static void shl__fill_generic(char *dst, const char *pattern, size_t size,
+                              bool stream)
+{
+    size_t i;
+    for (i = 0; i + SHL_SIMD_ALIGN <= size; i += SHL_SIMD_ALIGN) {
+        memcpy(dst + i, pattern, SHL_SIMD_ALIGN);
+    }
+    shl__fill_tail(dst + i, pattern, size - i);
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("sse2")))
+static void shl__copy_stream_sse2(char *dst, const char *src, size_t size)
+{
+    size_t i;
+    for (i = 0; i + 64 <= size; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (src + i));
+        __m128i b = _mm_loadu_si128((const __m128i*) (src + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*) (src + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i*) (src + i + 48));
+        _mm_stream_si128((__m128i*) (dst + i), a);
+        _mm_stream_si128((__m128i*) (dst + i + 16), b);
+        _mm_stream_si128((__m128i*) (dst + i + 32), c);
+        _mm_stream_si128((__m128i*) (dst + i + 48), d);
+    }
+    _mm_sfence();
+    memcpy(dst + i, src + i, size - i);
+}
+
+__attribute__((target("sse2")))
+static void shl__fill_sse2(char *dst, const char *pattern, size_t size,
+                           bool stream)
+{
+    __m128i a = _mm_load_si128((const __m128i*) pattern);
+    __m128i b = _mm_load_si128((const __m128i*) (pattern + 16));
+    __m128i c = _mm_load_si128((const __m128i*) (pattern + 32));
+    __m128i d = _mm_load_si128((const __m128i*) (pattern + 48));
+
+    size_t i;
+    if (stream) {
+        for (i = 0; i + 64 <= size; i += 64) {
+            _mm_stream_si128((__m128i*) (dst + i), a);
+            _mm_stream_si128((__m128i*) (dst + i + 16), b);
+            _mm_stream_si128((__m128i*) (dst + i + 32), c);
+            _mm_stream_si128((__m128i*) (dst + i + 48), d);
+        }
+        _mm_sfence();
+    } else {
+        for (i = 0; i + 64 <= size; i += 64) {
+            _mm_store_si128((__m128i*) (dst + i), a);
+            _mm_store_si128((__m128i*) (dst + i + 16), b);
+            _mm_store_si128((__m128i*) (dst + i + 32), c);
+            _mm_store_si128((__m128i*) (dst + i + 48), d);
+        }
+    }
+    shl__fill_tail(dst + i, pattern, size - i);
+}
+
+__attribute__((target("avx2")))
+static void shl__copy_stream_avx2(char *dst, const char *src, size_t size)
+{
+    size_t i;
+    for (i = 0; i + 64 <= size; i += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i*) (src + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*) (src + i + 32));
+        _mm256_stream_si256((__m256i*) (dst + i), a);
+        _mm256_stream_si256((__m256i*) (dst + i + 32), b);
+    }
+    _mm_sfence();
+    memcpy(dst + i, src + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static void shl__fill_avx2(char *dst, const char *pattern, size_t size,
+                           bool stream)
+{
+    __m256i a = _mm256_load_si256((const __m256i*) pattern);
+    __m256i b = _mm256_load_si256((const __m256i*) (pattern + 32));
+
+    size_t i;
+    if (stream) {
+        for (i = 0; i + 64 <= size; i += 64) {
+            _mm256_stream_si256((__m256i*) (dst + i), a);
+            _mm256_stream_si256((__m256i*) (dst + i + 32), b);
+        }
+        _mm_sfence();
+    } else {
+        for (i = 0; i + 64 <= size; i += 64) {
+            _mm256_store_si256((__m256i*) (dst + i), a);
+            _mm256_store_si256((__m256i*) (dst + i + 32), b);
+        }
+    }
+    shl__fill_tail(dst + i, pattern, size - i);
+}
+
+__attribute__((target("avx512f")))
+static void shl__copy_stream_avx512(char *dst, const char *src, size_t size)
+{
+    size_t i;
+    for (i = 0; i + 64 <= size; i += 64) {
+        __m512i a = _mm512_loadu_si512((const void*) (src + i));
+        _mm512_stream_si512((__m512i*) (dst + i), a);
+    }
+    _mm_sfence();
+    memcpy(dst + i, src + i, size - i);
+}
+
+__attribute__((target("avx512f")))
+static void shl__fill_avx512(char *dst, const char *pattern, size_t size,
+                             bool stream)
+{
+    __m512i a = _mm512_load_si512((const void*) pattern);
+
+    size_t i;
+    if (stream) {
+        for (i = 0; i + 64 <= size; i += 64) {
+            _mm512_stream_si512((__m512i*) (dst + i), a);
+        }
+        _mm_sfence();
+    } else {
+        for (i = 0; i + 64 <= size; i += 64) {
+            _mm512_store_si512((void*) (dst + i), a);
+        }
+    }
+    shl__fill_tail(dst + i, pattern, size - i);
+}
+
+#endif /* __x86_64__ */
+
+/*
+ * -------------------------------------------------------------------------------
+ * Runtime dispatch
+ * -------------------------------------------------------------------------------
+ */
+
+struct shl__simd_kernels {
+    const char *name;
+    shl__copy_kernel_t copy_stream;
+    shl__fill_kernel_t fill;
+};
+
+static struct shl__simd_kernels shl__simd_select(void)
+{
+    struct shl__simd_kernels k = {
+        "generic", shl__copy_generic, shl__fill_generic
+    };
+
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        k.name = "avx512";
+        k.copy_stream = shl__copy_stream_avx512;
+        k.fill = shl__fill_avx512;
+    } else if (__builtin_cpu_supports("avx2")) {
+        k.name = "avx2";
+        k.copy_stream = shl__copy_stream_avx2;
+        k.fill = shl__fill_avx2;
+    } else {
+        k.name = "sse2";
+        k.copy_stream = shl__copy_stream_sse2;
+        k.fill = shl__fill_sse2;
+    }
+#endif
+
+    return k;
+}
+
+static const struct shl__simd_kernels shl__simd = shl__simd_select();
+
+/**
+ * \brief returns the name of the kernels selected for this machine
+ */
+const char *shl__simd_name(void)
+{
+    return shl__simd.name;
+}
+
+/*
+ * -------------------------------------------------------------------------------
+ * Single threaded copy/fill
+ * -------------------------------------------------------------------------------
+ */
+
+/**
+ * \brief Copy size bytes from src to dst
+ *
+ * \param stream use non-temporal stores, i.e. bypass the cache
+ *
+ * Cached copies are left to the C library's memcpy, which is already
+ * vectorized for the machine.
+ */
+void shl__memcpy_simd(void *dst, const void *src, size_t size, bool stream)
+{
+    if (!stream || size < 2*SHL_SIMD_ALIGN) {
+        memcpy(dst, src, size);
+        return;
+    }
+
+    char *d = (char*) dst;
+    const char *s = (const char*) src;
+
+    size_t head = (SHL_SIMD_ALIGN - ((uintptr_t) d % SHL_SIMD_ALIGN))
+        % SHL_SIMD_ALIGN;
+    memcpy(d, s, head);
+
+    shl__simd.copy_stream(d + head, s + head, size - head);
+}
+
+/**
+ * \brief Fill size bytes at dst with copies of an element
+ *
+ * \param value        the element
+ * \param element_size size of the element in bytes
+ * \param stream       use non-temporal stores, i.e. bypass the cache
+ *
+ * dst is assumed to point to the beginning of an element.
+ */
+void shl__memset_simd(void *dst, const void *value, size_t element_size,
+                      size_t size, bool stream)
+{
+    char *d = (char*) dst;
+    const char *v = (const char*) value;
+
+    if (SHL_SIMD_ALIGN % element_size != 0) {
+        // Element does not tile a vector
+        size_t i;
+        for (i = 0; i + element_size <= size; i += element_size) {
+            memcpy(d + i, v, element_size);
+        }
+        memcpy(d + i, v, size - i);
+        return;
+    }
+
+    size_t head = (SHL_SIMD_ALIGN - ((uintptr_t) d % SHL_SIMD_ALIGN))
+        % SHL_SIMD_ALIGN;
+    head = std::min(head, size);
+
+    for (size_t i = 0; i < head; i++) {
+        d[i] = v[i % element_size];
+    }
+
+    // Pattern as seen from the first aligned address
+    char pattern[SHL_SIMD_ALIGN] __attribute__((aligned(SHL_SIMD_ALIGN)));
+    for (size_t i = 0; i < SHL_SIMD_ALIGN; i++) {
+        pattern[i] = v[(head + i) % element_size];
+    }
+
+    shl__simd.fill(d + head, pattern, size - head, stream);
+}
+
+/*
+ * -------------------------------------------------------------------------------
+ * Parallel copy/fill
+ *
+ * Work is divided in runs of whole pages of the destination, so that
+ * no page is written by more than one thread.
+ * -------------------------------------------------------------------------------
+ */
+
+/**
+ * \brief Determine part [from, to) of size bytes at dst handled by a thread
+ *
+ * Boundaries are at page boundaries of dst, which are multiples of
+ * element_size away from dst if the element tiles a page. Otherwise,
+ * work is divided by elements.
+ */
+static void shl__parallel_range(void *dst, size_t size, size_t element_size,
+                                int tid, int nt, size_t *from, size_t *to)
+{
+    uintptr_t d = (uintptr_t) dst;
+
+    if (PAGESIZE % element_size != 0 || d % element_size != 0) {
+        size_t elements = size / element_size;
+        *from = elements * tid / nt * element_size;
+        *to = (tid + 1 == nt) ? size : elements * (tid+1) / nt * element_size;
+        return;
+    }
+
+    size_t head = std::min(size, (size_t) ((PAGESIZE - d % PAGESIZE) % PAGESIZE));
+    size_t pages = (size - head + PAGESIZE - 1) / PAGESIZE;
+
+    size_t first = pages * tid / nt;
+    size_t last = pages * (tid+1) / nt;
+
+    *from = (tid == 0) ? 0 : std::min(size, head + first * PAGESIZE);
+    *to = (tid + 1 == nt) ? size : std::min(size, head + last * PAGESIZE);
+}
+
+/**
+ * \brief Copy size bytes from src to dst using all threads
+ *
+ * Uses non-temporal stores for copies of at least SHL_STREAM_THRESHOLD
+ * bytes. Runs on the calling thread only when called from within a
+ * parallel region or for small copies.
+ */
+void shl__memcpy_parallel(void *dst, const void *src, size_t size)
+{
+    bool stream = size >= SHL_STREAM_THRESHOLD;
+
+    if (size < SHL_PARALLEL_THRESHOLD || omp_in_parallel()) {
+        shl__memcpy_simd(dst, src, size, stream);
+        return;
+    }
+
+#pragma omp parallel
+    {
+        size_t from, to;
+        shl__parallel_range(dst, size, 1, omp_get_thread_num(),
+                            omp_get_num_threads(), &from, &to);
+        if (to > from) {
+            shl__memcpy_simd((char*) dst + from, (const char*) src + from,
+                             to - from, stream);
+        }
+    }
+}
+
+/**
+ * \brief Fill size bytes at dst with copies of an element using all threads
+ *
+ * \see shl__memcpy_parallel
+ */
+void shl__memset_parallel(void *dst, const void *value, size_t element_size,
+                          size_t size)
+{
+    bool stream = size >= SHL_STREAM_THRESHOLD;
+
+    if (size < SHL_PARALLEL_THRESHOLD || omp_in_parallel()) {
+        shl__memset_simd(dst, value, element_size, size, stream);
+        return;
+    }
+
+#pragma omp parallel
+    {
+        size_t from, to;
+        shl__parallel_range(dst, size, element_size, omp_get_thread_num(),
+                            omp_get_num_threads(), &from, &to);
+        if (to > from) {
+            shl__memset_simd((char*) dst + from, value, element_size,
+                             to - from, stream);
+        }
+    }
+}
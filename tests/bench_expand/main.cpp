@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2014 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+/*
+ * False sharing of per-thread state
+ *
+ * expand() and collapse() update per-thread state of the array and
+ * invalidate cached replica pointers. This compares densely packed
+ * per-thread flags with shl_per_thread, and a shared invalidation
+ * counter with the per-thread one, before timing expand/collapse
+ * rounds of an expandable array. Differences only show with several
+ * threads on different cores.
+ */
+
+#include <iostream>
+#include <omp.h>
+#include "shl.h"
+#include "shl_arrays.hpp"
+
+#define NUM_UPDATES (20*1000*1000)
+#define NUM_ROUNDS (100*1000)
+#define ARRAY_ELEMENTS (1024*1024)
+
+using namespace std;
+
+/**
+ * \brief Returns ns per update of a per-thread flag, updated by all
+ * threads at the same time
+ */
+template <class F>
+static double bench_flags(F &flags)
+{
+    double t = omp_get_wtime();
+
+#pragma omp parallel
+    {
+        volatile bool *f = &flags[shl__get_tid()];
+        for (long i=0; i<NUM_UPDATES; i++) {
+            *f = !*f;
+        }
+    }
+
+    return (omp_get_wtime() - t) * 1e9 / NUM_UPDATES;
+}
+
+/**
+ * \brief Returns ns per invalidation of cached replica pointers
+ */
+static double bench_epoch(void (*bump)(void))
+{
+    double t = omp_get_wtime();
+
+#pragma omp parallel
+    {
+        for (long i=0; i<NUM_UPDATES; i++) {
+            bump();
+        }
+    }
+
+    return (omp_get_wtime() - t) * 1e9 / NUM_UPDATES;
+}
+
+/**
+ * \brief Returns us per expand/collapse round, with one write and one
+ * read per round and thread
+ */
+static double bench_rounds(shl_array_expandable<int> *a)
+{
+    double t = omp_get_wtime();
+
+#pragma omp parallel
+    {
+        shl_rep_thread_ptr<int> p(a);
+        size_t i = shl__get_tid();
+
+        for (long r=0; r<NUM_ROUNDS; r++) {
+            a->expand();
+            p.set(i, p.get(i) + 1);
+            a->collapse();
+        }
+    }
+
+    return (omp_get_wtime() - t) * 1e6 / NUM_ROUNDS;
+}
+
+int main()
+{
+    shl__init(omp_get_max_threads(), true);
+
+    printf("threads: %d, cacheline: %d (padding %d)\n",
+           omp_get_max_threads(), shl__cacheline_size(), CACHELINE);
+
+    bool *packed = new bool[shl__max_threads()]();
+    shl_per_thread<bool> padded;
+
+    printf("flag update [ns]:  packed %6.2f  shl_per_thread %6.2f\n",
+           bench_flags(packed), bench_flags(padded));
+
+    printf("invalidate [ns]:   shared %6.2f  per-thread %6.2f\n",
+           bench_epoch(shl__rep_epoch_bump),
+           bench_epoch(shl__rep_thread_epoch_bump));
+
+    shl_array_expandable<int> *a =
+        new shl_array_expandable<int>(ARRAY_ELEMENTS, "bench_expand", shl__get_rep_id);
+    a->set_used(1);
+    a->alloc();
+
+    printf("expand/collapse [us/round]: %6.2f\n", bench_rounds(a));
+
+    delete a;
+    delete[] packed;
+
+    return 0;
+}
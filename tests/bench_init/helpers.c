@@ -1,3 +1,4 @@
+#ifdef BARRELFISH
 #include <barrelfish/barrelfish.h>
 #include <bench/bench.h>
 #include <omp.h>
@@ -26,3 +27,34 @@ uint64_t timer_stop(void)
     return timer;
     return bench_tsc_to_ms(timer);
 }
+
+#else
+#include <stdint.h>
+#include <time.h>
+
+#include "bench_init.h"
+
+void shl_bench_init(void)
+{
+}
+
+static uint64_t timer;
+
+static uint64_t timer_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void timer_start(void)
+{
+    timer = timer_now_ms();
+}
+
+uint64_t timer_stop(void)
+{
+    return timer_now_ms() - timer;
+}
+
+#endif
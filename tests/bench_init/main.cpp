@@ -14,7 +14,11 @@ int main(int argc, char *argv[])
     shl_bench_init();
 
     // This program is sometimes segfaulting on malloc .. no idea why ..
+#ifdef BARRELFISH
     shl__init(99, true);
+#else
+    shl__init(omp_get_max_threads(), true);
+#endif
 
     shl_array<ARRAY_TYPE> *src = new shl_array_single_node<ARRAY_TYPE>(ARRAY_ELEMENTS, "shl__source");
     shl_array<ARRAY_TYPE> *dst = new shl_array_single_node<ARRAY_TYPE>(ARRAY_ELEMENTS, "shl__dest");
@@ -53,7 +57,9 @@ int main(int argc, char *argv[])
     }
 
     printf("DONE.\n");
+#ifdef BARRELFISH
     while(1);
+#endif
 
 
 
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2014 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+/*
+ * Cost of replica lookups
+ *
+ * Compares the static lookup (replica_lookup, filled from
+ * SHL_CPU_AFFINITY) with the dynamic one (current CPU, enabled with
+ * SHL_DYNAMIC_LOOKUP=1), both per call and when reading a replicated
+ * array. Run once with each setting.
+ */
+
+#include <iostream>
+#include <omp.h>
+#include "shl.h"
+#include "shl_arrays.hpp"
+
+#define NUM_LOOKUPS (50*1000*1000)
+#define ARRAY_ELEMENTS (16*1024*1024)
+#define BATCH_ELEMENTS 4096
+#define REPETITIONS 5
+
+using namespace std;
+
+typedef int (*lookup_fn_t)(void);
+
+static int static_lookup(void)
+{
+    return shl__lookup_rep_id(shl__get_tid());
+}
+
+/**
+ * \brief Returns ns per call of fn, averaged over all threads
+ */
+static double bench_lookup(lookup_fn_t fn)
+{
+    long sum = 0;
+    double t = omp_get_wtime();
+
+#pragma omp parallel reduction(+:sum)
+    {
+        for (long i=0; i<NUM_LOOKUPS; i++) {
+            sum += fn();
+        }
+    }
+
+    t = omp_get_wtime() - t;
+
+    // Keep the loop
+    if (sum < 0) {
+        printf("%ld\n", sum);
+    }
+
+    return t * 1e9 / NUM_LOOKUPS;
+}
+
+/**
+ * \brief Returns ns per element read from a replicated array
+ *
+ * \param batch re-validate the replica every batch elements, 0 to use
+ *     get() of the array for every element
+ */
+static double bench_read(shl_array_replicated<int> *a, size_t batch)
+{
+    long sum = 0;
+    double t = omp_get_wtime();
+
+    for (int r=0; r<REPETITIONS; r++) {
+
+#pragma omp parallel reduction(+:sum)
+        {
+            shl_rep_thread_ptr<int> p(a);
+
+#pragma omp for schedule(static, BATCH_ELEMENTS)
+            for (size_t i=0; i<a->get_size(); i++) {
+                if (batch == 0) {
+                    sum += a->get(i);
+                } else {
+                    if (i % batch == 0) {
+                        p.revalidate();
+                    }
+                    sum += p.get(i);
+                }
+            }
+        }
+    }
+
+    t = omp_get_wtime() - t;
+
+    if (sum < 0) {
+        printf("%ld\n", sum);
+    }
+
+    return t * 1e9 / (REPETITIONS * (double) a->get_size());
+}
+
+int main()
+{
+    shl__init(omp_get_max_threads(), true);
+
+    shl_array_replicated<int> *a =
+        new shl_array_replicated<int>(ARRAY_ELEMENTS, "bench_lookup", shl__get_rep_id);
+    a->set_used(1);
+    a->alloc();
+    a->init_from_value(1);
+
+    printf("threads: %d, dynamic lookup: %d\n",
+           omp_get_max_threads(), get_conf()->use_dynamic_lookup);
+
+    printf("lookup [ns/call]:  static %6.2f  current CPU %6.2f  "
+           "shl__get_rep_id %6.2f\n",
+           bench_lookup(static_lookup), bench_lookup(shl__get_cur_rep_id),
+           bench_lookup(shl__get_rep_id));
+
+    printf("read [ns/element]: get() %6.2f  cached, batch %d %6.2f  "
+           "cached, batch 1 %6.2f\n",
+           bench_read(a, 0), BATCH_ELEMENTS, bench_read(a, BATCH_ELEMENTS),
+           bench_read(a, 1));
+
+    delete a;
+
+    return 0;
+}
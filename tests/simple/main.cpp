@@ -1,4 +1,6 @@
 #include <iostream>
+#include <algorithm>
+#include <pthread.h>
 #include "shl.h"
 #include "shl_arrays.hpp"
 
@@ -99,7 +101,54 @@ static bool test_partitioned(size_t s)
 
 static bool test_replicated(size_t s)
 {
-    return true;
+    std::cout << "Replicated Array" << std::endl;
+
+    shl_array_replicated<float> *ac =
+        new shl_array_replicated<float>(s, "Test Replicated Array", shl__get_rep_id);
+    ac->set_used(1);
+    ac->alloc();
+
+    float *src = new float[s];
+    for (unsigned int i=0; i<s; i++) {
+        src[i] = i;
+    }
+
+    std::cout << "Copying into replicas..." << std::endl;
+    ac->copy_from(src);
+
+    std::cout << "Verifying contents..." << std::endl;
+
+    bool pass = true;
+    for (int j=0; j<shl__get_num_replicas(); j++) {
+        for (unsigned int i=0; i<s; i++) {
+            if (ac->rep_array[j][i] != i) {
+                std::cout << "Wrong element @" << i << " in replica " << j << std::endl;
+                pass = false;
+                break;
+            }
+        }
+    }
+
+    std::cout << "Initializing from value..." << std::endl;
+    ac->init_from_value(42);
+
+    for (int j=0; j<shl__get_num_replicas(); j++) {
+        for (unsigned int i=0; i<s; i++) {
+            if (ac->rep_array[j][i] != 42) {
+                std::cout << "Wrong element @" << i << " in replica " << j << std::endl;
+                pass = false;
+                break;
+            }
+        }
+    }
+
+    std::cout << (pass ? "[PASS]" : "[FAIL]") << std::endl;
+
+    // src is the master copy, it has to outlive the array
+    delete ac;
+    delete[] src;
+
+    return pass;
 }
 
 static bool test_distributed(size_t s)
@@ -147,10 +196,632 @@ static bool test_distributed(size_t s)
     return true;
 }
 
+static bool test_dynamic(size_t s)
+{
+    std::cout << "Dynamic Array" << std::endl;
+
+    // Released mappings are pooled, so the next array reuses them
+    float *prev = NULL;
+    for (int round=0; round<3; round++) {
+
+        shl_array<float> *ac = new shl_array<float>(s, "Test Dynamic Array");
+        ac->set_used(1);
+        ac->set_dynamic(1);
+        ac->alloc();
+        ac->init_from_value(round);
+
+        float *a = ac->get_array();
+
+        std::cout << "Round " << round << "... " << a << std::endl;
+
+        if (a == NULL) {
+            return 0;
+        }
+
+        if (prev != NULL && a != prev) {
+            std::cout << "Mapping not reused" << std::endl;
+            std::cout << "[FAIL]" << std::endl;
+            delete ac;
+            return false;
+        }
+
+        // Verify content
+        for (unsigned int i=0; i<s; i++) {
+            if (a[i] != round) {
+                std::cout << "Wrong element @" << i << std::endl;
+                return 0;
+            }
+        }
+
+        prev = a;
+        delete ac;
+    }
+
+    std::cout << "[PASS]" << std::endl;
+
+    return true;
+}
+
+static bool test_migrate(size_t s)
+{
+    std::cout << "Migrated Array" << std::endl;
+
+    shl_array<float> *ac = new shl_array<float>(s, "Test Migrated Array");
+    ac->set_used(1);
+    ac->alloc();
+
+    float *a = ac->get_array();
+    if (a == NULL) {
+        return 0;
+    }
+
+    for (unsigned int i=0; i<s; i++) {
+        a[i] = i;
+    }
+
+    // Re-place under every policy, contents must not change
+    bool pass = ac->migrate_distributed(PAGESIZE) == 0 &&
+        ac->migrate_partitioned(SHL_PARTITION_CHUNK) == 0 &&
+        ac->migrate(0) == 0 && ac->get_array() == a;
+
+    std::cout << "Verifying contents..." << std::endl;
+
+    for (unsigned int i=0; i<s && pass; i++) {
+        if (a[i] != i) {
+            std::cout << "Wrong element @" << i << std::endl;
+            pass = false;
+        }
+    }
+
+    // Node lookups of distributed arrays follow the new placement
+    shl_array_distributed<float> *ad =
+        new shl_array_distributed<float>(s, "Test Migrated Distributed Array");
+    ad->set_used(1);
+    ad->alloc();
+
+    pass = pass && ad->migrate_partitioned(SHL_PARTITION_CHUNK) == 0;
+    for (size_t i=0; i<s && pass; i++) {
+        pass = ad->get_node(i) >= 0 && ad->get_node(i) <= shl__max_node();
+    }
+
+    pass = pass && ad->migrate(0) == 0;
+    for (size_t i=0; i<s && pass; i++) {
+        pass = ad->get_node(i) == 0;
+    }
+
+    std::cout << (pass ? "[PASS]" : "[FAIL]") << std::endl;
+
+    delete ad;
+    delete ac;
+
+    return pass;
+}
+
+/**
+ * \brief Writes i to every element i through a view, then reads back
+ */
+struct view_fill {
+    size_t s;
+    bool pass;
+
+    template <class V>
+    void operator()(V &v)
+    {
+        for (size_t i=0; i<s; i++) {
+            v.set(i, i);
+        }
+        for (size_t i=0; i<s; i++) {
+            if (v.get(i) != i) {
+                std::cout << "Wrong element @" << i << std::endl;
+                pass = false;
+                return;
+            }
+        }
+    }
+};
+
+static bool test_view(size_t s)
+{
+    std::cout << "Array Views" << std::endl;
+
+    shl_array<float> *arrays[] = {
+        new shl_array<float>(s, "Test View Array"),
+        new shl_array_replicated<float>(s, "Test View Replicated Array",
+                                        shl__get_rep_id)
+    };
+
+    bool pass = true;
+    for (int j=0; j<2; j++) {
+
+        arrays[j]->set_used(1);
+        arrays[j]->alloc();
+
+        view_fill f = { s, true };
+        shl__view_dispatch(arrays[j], f);
+        pass = pass && f.pass;
+
+        // Writes went to the array itself
+        for (size_t i=0; i<s && pass; i++) {
+            if (arrays[j]->get(i) != i) {
+                std::cout << "Wrong element @" << i << std::endl;
+                pass = false;
+            }
+        }
+
+        delete arrays[j];
+    }
+
+    std::cout << (pass ? "[PASS]" : "[FAIL]") << std::endl;
+
+    return pass;
+}
+
+static bool test_rep_ptr(size_t s)
+{
+    std::cout << "Cached Replica Pointers" << std::endl;
+
+    shl_array_replicated<float> *ac =
+        new shl_array_replicated<float>(s, "Test Rep Ptr Array", shl__get_rep_id);
+    ac->set_used(1);
+    ac->alloc();
+
+    shl_rep_thread_ptr<float> p(ac);
+
+    for (size_t i=0; i<s; i++) {
+        p.set(i, i);
+    }
+
+    // Pointers have to be resolved again, the contents stay
+    shl__rep_epoch_bump();
+
+    bool pass = p.get_array() == ac->get_array();
+    for (size_t i=0; i<s && pass; i++) {
+        if (p.get(i) != i || ac->get(i) != i) {
+            std::cout << "Wrong element @" << i << std::endl;
+            pass = false;
+        }
+    }
+
+    std::cout << (pass ? "[PASS]" : "[FAIL]") << std::endl;
+
+    delete ac;
+
+    return pass;
+}
+
+struct registry_arg {
+    shl_array_replicated<float> *ac;
+    int explicit_tid;   ///< tid to register with, -1 for implicit
+    int tid;
+    bool pass;
+};
+
+static void* registry_worker(void *a)
+{
+    struct registry_arg *arg = (struct registry_arg*) a;
+
+    if (arg->explicit_tid >= 0) {
+        shl__register_thread(arg->explicit_tid);
+    }
+
+    arg->tid = shl__get_tid();
+    arg->pass = shl__get_rep_id() >= 0 &&
+        shl__get_rep_id() < arg->ac->get_num_replicas();
+
+    for (size_t i=0; i<arg->ac->get_size() && arg->pass; i++) {
+        arg->pass = arg->ac->get(i) == i;
+    }
+
+    shl__deregister_thread();
+
+    return NULL;
+}
+
+static bool test_registry(size_t s)
+{
+    std::cout << "Non-OpenMP Threads" << std::endl;
+
+    shl_array_replicated<float> *ac =
+        new shl_array_replicated<float>(s, "Test Registry Array", shl__get_rep_id);
+    ac->set_used(1);
+    ac->alloc();
+
+    for (size_t i=0; i<s; i++) {
+        ac->set(i, i);
+    }
+
+    struct registry_arg args[3] = {
+        { ac, -1, -1, false },
+        { ac, -1, -1, false },
+        { ac, shl__max_threads()-1, -1, false }
+    };
+    pthread_t threads[3];
+
+    // Run one at a time, so the second thread reuses the id of the first
+    bool pass = true;
+    for (int t=0; t<3; t++) {
+        pthread_create(&threads[t], NULL, registry_worker, &args[t]);
+        pthread_join(threads[t], NULL);
+        pass = pass && args[t].pass;
+    }
+
+    // Implicit ids are not those of OpenMP threads
+    pass = pass && args[0].tid >= shl__num_threads() &&
+        args[1].tid == args[0].tid && args[2].tid == shl__max_threads()-1;
+
+    std::cout << (pass ? "[PASS]" : "[FAIL]") << std::endl;
+
+    delete ac;
+
+    return pass;
+}
+
+static bool test_topology(void)
+{
+    std::cout << "Topology" << std::endl;
+
+    const int *cpus;
+    int num_cpus = shl__topo_allowed_cpus(&cpus);
+
+    bool pass = num_cpus > 0;
+    for (int i=0; i<num_cpus && pass; i++) {
+
+        int cpu = cpus[i];
+        int node = shl__topo_cpu_node(cpu);
+
+        // Every usable CPU is listed with its node
+        const int *node_cpus;
+        int n = shl__topo_node_cpus(node, &node_cpus);
+        bool found = false;
+        for (int j=0; j<n; j++) {
+            found = found || node_cpus[j] == cpu;
+        }
+
+        pass = found && shl__topo_cpu_allowed(cpu) &&
+            shl__topo_cpu_core(cpu) <= cpu && shl__topo_cpu_llc(cpu) <= cpu &&
+            shl__topo_node_distance(node, node) == 10;
+    }
+
+    pass = pass && shl__is_rep_coordinator(0) &&
+        shl__rep_coordinator(shl__lookup_rep_id(0)) == 0;
+
+    std::cout << (pass ? "[PASS]" : "[FAIL]") << std::endl;
+
+    return pass;
+}
+
+static bool test_auto_tune(void)
+{
+    std::cout << "Auto-tuned Binding" << std::endl;
+
+    int num_cpus = shl__topo_allowed_cpus(NULL);
+    coreid_t *bind = new coreid_t[num_cpus];
+
+    // One thread per core, on distinct usable CPUs
+    int num = 0;
+    shl__auto_tune_bind(&num, bind, true);
+
+    bool pass = num > 0 && num <= num_cpus;
+    for (int i=0; i<num && pass; i++) {
+        pass = shl__topo_cpu_allowed(bind[i]);
+        for (int j=0; j<i; j++) {
+            pass = pass && shl__topo_cpu_core(bind[i]) != shl__topo_cpu_core(bind[j]);
+        }
+    }
+
+    // Limited to the requested number of threads
+    int limit = 1;
+    shl__auto_tune_bind(&limit, bind, false);
+    pass = pass && limit == 1 && shl__topo_cpu_allowed(bind[0]);
+
+    std::cout << (pass ? "[PASS]" : "[FAIL]") << std::endl;
+
+    delete[] bind;
+
+    return pass;
+}
+
+static bool test_rep_placement(void)
+{
+    std::cout << "Replica Placement" << std::endl;
+
+    int num_replicas = shl__get_num_replicas();
+    bool pass = num_replicas > 0;
+
+    // Every node reads from its nearest replica
+    for (int n=0; n<=shl__max_node() && pass; n++) {
+
+        int r = shl__rep_of_node(n);
+        pass = r >= 0 && r < num_replicas;
+
+        for (int s=0; s<num_replicas && pass; s++) {
+            pass = shl__node_distance(n, shl__get_rep_node(r)) <=
+                shl__node_distance(n, shl__get_rep_node(s));
+        }
+    }
+
+    std::cout << (pass ? "[PASS]" : "[FAIL]") << std::endl;
+
+    return pass;
+}
+
+static bool test_rep_domain(size_t s)
+{
+    std::cout << "Replication Domains" << std::endl;
+
+    int num_cpus = shl__topo_num_cpus();
+    int *group = new int[num_cpus];
+    for (int c=0; c<num_cpus; c++) {
+        group[c] = 0;
+    }
+
+    struct shl_rep_domain *domains[2] = {
+        shl__rep_domain_llc(),
+        shl__rep_domain_custom(group, num_cpus)
+    };
+
+    bool pass = domains[0] != NULL && domains[1] != NULL &&
+        shl__rep_domain_num(domains[1]) == 1;
+
+    for (int d=0; d<2 && pass; d++) {
+
+        shl_array_replicated<float> *ac =
+            new shl_array_replicated<float>(s, "Test Domain Array", shl__get_rep_id);
+        ac->set_used(1);
+        ac->set_domain(domains[d]);
+        ac->alloc();
+        ac->init_from_value(2);
+
+        int r = shl__rep_domain_lookup(domains[d]);
+        pass = ac->get_num_replicas() == shl__rep_domain_num(domains[d]) &&
+            r >= 0 && r < ac->get_num_replicas() &&
+            ac->get_array() == ac->rep_array[r];
+
+        for (int j=0; j<ac->get_num_replicas() && pass; j++) {
+            for (size_t i=0; i<s; i++) {
+                pass = pass && ac->rep_array[j][i] == 2;
+            }
+        }
+
+        delete ac;
+    }
+
+    std::cout << (pass ? "[PASS]" : "[FAIL]") << std::endl;
+
+    shl__rep_domain_free(domains[0]);
+    shl__rep_domain_free(domains[1]);
+    delete[] group;
+
+    return pass;
+}
+
+static bool test_wr_rep(size_t s)
+{
+    std::cout << "Write-replicated Array" << std::endl;
+
+    shl_array_wr_rep<float> *ac =
+        new shl_array_wr_rep<float>(s, "Test Wr-Rep Array", shl__get_rep_id);
+    ac->set_used(1);
+    ac->alloc();
+    ac->init_from_value(1);
+
+    bool pass = ac->get_num_replicas() == shl__get_num_replicas();
+
+    // Writes through the view and the array reach every replica
+    view_fill f = { s, true };
+    shl__view_dispatch<float>(ac, f);
+    ac->set(0, 42);
+
+    for (int j=0; j<ac->get_num_replicas() && pass; j++) {
+        pass = ac->rep_array[j][0] == 42;
+        for (size_t i=1; i<s && pass; i++) {
+            pass = ac->rep_array[j][i] == i;
+        }
+    }
+    pass = pass && f.pass;
+
+    // Unrolled and generic writes for more replicas than nodes
+    for (int num=1; num<=10 && pass; num++) {
+
+        float *copies[10];
+        for (int j=0; j<num; j++) {
+            copies[j] = new float[4]();
+        }
+
+        shl__rep_write_all(copies, num, 3, 7.0f);
+        for (int j=0; j<num; j++) {
+            pass = pass && copies[j][3] == 7 && copies[j][2] == 0;
+            delete[] copies[j];
+        }
+    }
+
+    std::cout << (pass ? "[PASS]" : "[FAIL]") << std::endl;
+
+    delete ac;
+
+    return pass;
+}
+
+static bool test_expandable(size_t s)
+{
+    std::cout << "Expandable Array" << std::endl;
+
+    // Small write sets, so that they are written back early
+    shl_array_expandable<int> *ac =
+        new shl_array_expandable<int>(s, "Test Expandable Array", shl__get_rep_id,
+                                      s / 16 * sizeof(size_t));
+    ac->set_used(1);
+    ac->alloc();
+    ac->init_from_value(1);
+
+    int *master = ac->shl_array<int>::get_array();
+    bool pass = true;
+
+    // Threads write disjoint indices to their local replica, merged
+    // on collapse
+#pragma omp parallel num_threads(shl__num_threads()) reduction(&&:pass)
+    {
+        ac->expand();
+        {
+            shl_rep_thread_ptr<int> p(ac);
+#pragma omp for schedule(static)
+            for (size_t i=0; i<s; i+=2) {
+                p.set(i, 2);
+                pass = pass && p.get(i) == 2;
+            }
+        }
+        ac->collapse();
+    }
+
+    for (int j=0; j<ac->get_num_replicas() && pass; j++) {
+        for (size_t i=0; i<s && pass; i++) {
+            pass = ac->rep_array[j][i] == (i % 2 ? 1 : 2) &&
+                master[i] == ac->rep_array[j][i];
+        }
+    }
+
+    // Collapsed writes reach the replicas on the next expand
+#pragma omp parallel num_threads(shl__num_threads())
+    {
+#pragma omp for schedule(static)
+        for (size_t i=1; i<s; i+=2) {
+            ac->set(i, 3);
+        }
+        ac->expand();
+        ac->collapse();
+    }
+
+    pass = pass && ac->get(1) == 3;
+    for (int j=0; j<ac->get_num_replicas() && pass; j++) {
+        for (size_t i=0; i<s && pass; i++) {
+            pass = ac->rep_array[j][i] == (i % 2 ? 3 : 2) &&
+                master[i] == ac->rep_array[j][i];
+        }
+    }
+
+    std::cout << (pass ? "[PASS]" : "[FAIL]") << std::endl;
+
+    delete ac;
+
+    return pass;
+}
+
+static bool test_oplog(size_t s)
+{
+    std::cout << "Operation-log Array" << std::endl;
+
+    // Small log, so that writers have to wrap around
+    shl_array_oplog<int> *ac =
+        new shl_array_oplog<int>(s, "Test Oplog Array", shl__get_rep_id, 64);
+    ac->set_used(1);
+    ac->alloc();
+    ac->init_from_value(1);
+
+    for (size_t i=0; i<s; i++) {
+        ac->set(i, i);
+    }
+    for (size_t i=0; i<s; i+=2) {
+        ac->add(i, 1);
+    }
+
+    bool pass = true;
+    for (size_t i=0; i<s && pass; i++) {
+        pass = ac->get(i) == (int) (i % 2 ? i : i + 1);
+    }
+
+    // Replicas nobody read from catch up on demand
+    ac->set(0, 42);
+    ac->sync_all();
+    for (int j=0; j<ac->get_num_replicas() && pass; j++) {
+        pass = ac->rep_array[j][0] == 42 && ac->rep_array[j][s-1] == (int) (s-1);
+    }
+
+    std::cout << (pass ? "[PASS]" : "[FAIL]") << std::endl;
+
+    delete ac;
+
+    return pass;
+}
+
+static bool test_part_rep(size_t s)
+{
+    std::cout << "Partitioned-replicated Array" << std::endl;
+
+    shl_array_part_rep<int> *ac =
+        new shl_array_part_rep<int>(s, "Test Part-Rep Array", shl__get_rep_id, 0);
+    ac->set_used(1);
+    ac->alloc();
+    ac->init_from_value(0);
+
+    // Owner computes, then all replicas receive the written parts
+    for (int it=1; it<=2; it++) {
+#pragma omp parallel for schedule(static) num_threads(shl__num_threads())
+        for (size_t i=0; i<s; i++) {
+            if (it == 1 || i % 3 == 0) {
+                ac->set(i, i + it);
+            }
+        }
+        ac->exchange();
+    }
+
+    bool pass = true;
+    for (int j=0; j<ac->get_num_replicas() && pass; j++) {
+        for (size_t i=0; i<s && pass; i++) {
+            pass = ac->rep_array[j][i] == (int) (i % 3 ? i + 1 : i + 2);
+        }
+    }
+    pass = pass && ac->get(3) == 5;
+
+    std::cout << (pass ? "[PASS]" : "[FAIL]") << std::endl;
+
+    delete ac;
+
+    return pass;
+}
+
+static bool test_double_buffered(size_t s)
+{
+    std::cout << "Double-buffered Array" << std::endl;
+
+    shl_array_double_buffered<int> *db =
+        shl__malloc_double_buffered<int>(s, "Test Double-buffered Array",
+                                         false, true, false, false, true);
+    db->alloc();
+    db->cur()->init_from_value(0);
+
+    shl_array<int> *cur = db->cur();
+    shl_array<int> *next = db->next();
+    int *mem = cur->get_array();
+
+    // next = cur + 1, then swap
+    for (int it=0; it<3; it++) {
+#pragma omp parallel
+        {
+#pragma omp for
+            for (size_t i=0; i<s; i++) {
+                next->set(i, cur->get(i) + 1);
+            }
+            db->swap();
+        }
+    }
+
+    bool pass = db->cur() == cur && cur->get_array() != mem;
+    for (size_t i=0; i<s && pass; i++) {
+        pass = cur->get(i) == 3 && next->get(i) == 2;
+    }
+
+    std::cout << (pass ? "[PASS]" : "[FAIL]") << std::endl;
+
+    delete db;
+
+    return pass;
+}
+
 int main()
 {
     // This program is sometimes segfaulting on malloc .. no idea why ..
-    shl__init(1, true);
+    // Several threads, so that the parallel tests run concurrently
+    shl__init(std::max(4, omp_get_max_threads()), true);
     std::cout << "Hello World!" << std::endl;
 
     std::cout << "==========================" << std::endl;
@@ -173,5 +844,47 @@ int main()
     std::cout << "--------------------------" << std::endl;
     test_distributed(1123);
 
+    std::cout << "==========================" << std::endl;
+    test_dynamic(16*1024);
+
+    std::cout << "==========================" << std::endl;
+    test_migrate(16*1024);
+
+    std::cout << "==========================" << std::endl;
+    test_view(16*1024);
+
+    std::cout << "==========================" << std::endl;
+    test_rep_ptr(16*1024);
+
+    std::cout << "==========================" << std::endl;
+    test_registry(16*1024);
+
+    std::cout << "==========================" << std::endl;
+    test_topology();
+
+    std::cout << "==========================" << std::endl;
+    test_auto_tune();
+
+    std::cout << "==========================" << std::endl;
+    test_rep_placement();
+
+    std::cout << "==========================" << std::endl;
+    test_rep_domain(16*1024);
+
+    std::cout << "==========================" << std::endl;
+    test_wr_rep(16*1024);
+
+    std::cout << "==========================" << std::endl;
+    test_expandable(16*1024);
+
+    std::cout << "==========================" << std::endl;
+    test_oplog(16*1024);
+
+    std::cout << "==========================" << std::endl;
+    test_part_rep(16*1024);
+
+    std::cout << "==========================" << std::endl;
+    test_double_buffered(16*1024);
+
     return 0;
 }